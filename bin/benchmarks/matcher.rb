@@ -39,7 +39,8 @@ results = TIMES.times.map do
               matcher.sorted_matches_for(
                 query,
                 :threads => threads,
-                :recurse => ENV.fetch('RECURSE', '1') == '1'
+                :recurse => ENV.fetch('RECURSE', '1') == '1',
+                :engine => ENV.fetch('ENGINE', 'iterative')
               )
               query
             end
@@ -2,6 +2,7 @@
 // Licensed under the terms of the BSD 2-clause license.
 
 #include "matcher.h"
+#include "prescan.h"
 #include "watchman.h"
 
 VALUE mCommandT              = 0; // module CommandT
@@ -27,9 +28,15 @@ void Init_ext() {
     mCommandT = rb_define_module("CommandT");
 
     // class CommandT::Matcher
+    prescan_init();
     cCommandTMatcher = rb_define_class_under(mCommandT, "Matcher", rb_cObject);
     rb_define_method(cCommandTMatcher, "initialize", CommandTMatcher_initialize, -1);
     rb_define_method(cCommandTMatcher, "sorted_matches_for", CommandTMatcher_sorted_matches_for, -1);
+    rb_define_method(cCommandTMatcher, "cancel", CommandTMatcher_cancel, 0);
+    rb_define_attr(cCommandTMatcher, "positions", 1, 0);
+    rb_define_attr(cCommandTMatcher, "thread_stats", 1, 0);
+    rb_define_attr(cCommandTMatcher, "cache_hits", 1, 0);
+    rb_define_attr(cCommandTMatcher, "cache_misses", 1, 0);
 
     // module CommandT::Watchman::Utils
     mCommandTWatchman = rb_define_module_under(mCommandT, "Watchman");
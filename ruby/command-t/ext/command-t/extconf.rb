@@ -40,6 +40,9 @@ if have_header('fcntl.h') &&
 end
 
 # optional
+have_header('immintrin.h') # sets HAVE_IMMINTRIN_H if found (for SIMD pre-scan)
+have_header('ruby/thread.h') # >= 2.0; sets HAVE_RUBY_THREAD_H (for releasing the GVL)
+
 if RbConfig::CONFIG['THREAD_MODEL'] == 'pthread'
   have_library('pthread', 'pthread_create') # sets HAVE_PTHREAD_H if found
 end
@@ -7,21 +7,21 @@
 
 #define HEAP_PARENT(index) ((index - 1) / 2)
 #define HEAP_LEFT(index) (2 * index + 1)
-#define HEAP_RIGHT(index) (2 * index + 2)
 
 /**
- * Returns a new heap, or NULL on failure.
+ * Returns a new top-k heap, whose entries refer to paths in `store`, or NULL
+ * on failure.
  */
-heap_t *heap_new(long capacity, heap_compare_entries comparator) {
-    heap_t *heap = malloc(sizeof(heap_t));
+topk_t *topk_new(long capacity, const store_t *store) {
+    topk_t *heap = malloc(sizeof(topk_t));
     if (!heap) {
         return NULL;
     }
     heap->capacity = capacity;
-    heap->comparator = comparator;
+    heap->store = store;
     heap->count = 0;
 
-    heap->entries = malloc(capacity * sizeof(void *));
+    heap->entries = malloc((capacity ? capacity : 1) * sizeof(topk_entry_t));
     if (!heap->entries) {
         free(heap);
         return NULL;
@@ -30,9 +30,9 @@ heap_t *heap_new(long capacity, heap_compare_entries comparator) {
 }
 
 /**
- * Frees a previously created heap.
+ * Frees a previously created top-k heap.
  */
-void heap_free(heap_t *heap) {
+void topk_free(topk_t *heap) {
     free(heap->entries);
     free(heap);
 }
@@ -40,107 +40,76 @@ void heap_free(heap_t *heap) {
 /**
  * @internal
  *
- * Compare values at indices `a_idx` and `b_idx` using the heap's comparator
- * function.
+ * Moves `entry` down from `idx` until the heap property is restored.
  */
-int heap_compare(heap_t *heap, long a_idx, long b_idx) {
-    const void *a = heap->entries[a_idx];
-    const void *b = heap->entries[b_idx];
-    return heap->comparator(a, b);
-}
-
-/**
- * @internal
- *
- * Returns 1 if the heap property holds (ie. parent < child).
- */
-int heap_property(heap_t *heap, long parent_idx, long child_idx) {
-    return heap_compare(heap, parent_idx, child_idx) > 0;
-}
-
-/**
- * @internal
- *
- * Swaps the values at indexes `a` and `b` within `heap`.
- */
-void heap_swap(heap_t *heap, long a, long b) {
-    void *tmp = heap->entries[a];
-    heap->entries[a] = heap->entries[b];
-    heap->entries[b] = tmp;
+static void topk_sift_down(topk_t *heap, long idx, topk_entry_t entry) {
+    long child_idx;
+
+    while ((child_idx = HEAP_LEFT(idx)) < heap->count) {
+        if (
+            child_idx + 1 < heap->count &&
+            topk_below(
+                heap,
+                &heap->entries[child_idx + 1],
+                &heap->entries[child_idx]
+            )
+        ) {
+            child_idx++;
+        }
+        if (!topk_below(heap, &heap->entries[child_idx], &entry)) {
+            break;
+        }
+        heap->entries[idx] = heap->entries[child_idx];
+        idx = child_idx;
+    }
+    heap->entries[idx] = entry;
 }
 
 /**
- * Inserts `value` into `heap`.
+ * Inserts path `index` with `score` into `heap`, which must not be full.
  */
-void heap_insert(heap_t *heap, void *value) {
+void topk_insert(topk_t *heap, float score, uint32_t index) {
     long idx, parent_idx;
+    topk_entry_t entry;
 
-    // If at capacity, ignore.
-    if (heap->count == heap->capacity) {
-        return;
-    }
+    entry.score = score;
+    entry.index = index;
 
-    // Insert into first empty slot.
-    idx = heap->count;
-    heap->entries[idx] = value;
-    heap->count++;
-
-    // Bubble upwards until heap property is restored.
-    parent_idx = HEAP_PARENT(idx);
-    while (idx && !heap_property(heap, parent_idx, idx)) {
-        heap_swap(heap, idx, parent_idx);
-        idx = parent_idx;
+    // Bubble the hole upwards, then fill it.
+    idx = heap->count++;
+    while (idx) {
         parent_idx = HEAP_PARENT(idx);
+        if (!topk_below(heap, &entry, &heap->entries[parent_idx])) {
+            break;
+        }
+        heap->entries[idx] = heap->entries[parent_idx];
+        idx = parent_idx;
     }
+    heap->entries[idx] = entry;
 }
 
 /**
- * @internal
- *
- * Restores the heap property starting at `idx`.
+ * Replaces the minimum entry of `heap`, which must not be empty, with path
+ * `index` and its `score`: equivalent to an extract followed by an insert,
+ * but in a single pass.
  */
-void heap_heapify(heap_t *heap, long idx) {
-    long left_idx = HEAP_LEFT(idx);
-    long right_idx = HEAP_RIGHT(idx);
-    long smallest_idx =
-        right_idx < heap->count ?
-
-        // Right (and therefore left) child exists.
-        (heap_compare(heap, left_idx, right_idx) > 0 ? left_idx : right_idx) :
-
-        left_idx < heap->count ?
+void topk_replace_top(topk_t *heap, float score, uint32_t index) {
+    topk_entry_t entry;
 
-        // Only left child exists.
-        left_idx :
-
-        // No children exist.
-        idx;
-
-    if (
-        smallest_idx != idx &&
-        !heap_property(heap, idx, smallest_idx)
-    ) {
-        // Swap with smallest_idx child.
-        heap_swap(heap, idx, smallest_idx);
-        heap_heapify(heap, smallest_idx);
-    }
+    entry.score = score;
+    entry.index = index;
+    topk_sift_down(heap, 0, entry);
 }
 
 /**
- * Extracts the minimum value from `heap`.
+ * Extracts the minimum entry from `heap`, which must not be empty.
  */
-void *heap_extract(heap_t *heap) {
-    void *extracted = NULL;
-    if (heap->count) {
-        // Grab root value.
-        extracted = heap->entries[0];
-
-        // Move last item to root.
-        heap->entries[0] = heap->entries[heap->count - 1];
-        heap->count--;
+topk_entry_t topk_extract(topk_t *heap) {
+    topk_entry_t extracted = heap->entries[0];
 
-        // Restore heap property.
-        heap_heapify(heap, 0);
+    heap->count--;
+    if (heap->count) {
+        topk_sift_down(heap, 0, heap->entries[heap->count]);
     }
     return extracted;
 }
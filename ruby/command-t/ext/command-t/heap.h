@@ -2,21 +2,45 @@
 // Licensed under the terms of the BSD 2-clause license.
 
 /**
- * A fixed size min-heap implementation.
+ * A fixed size min-heap of paths (by index into a store) and their scores,
+ * for keeping the top `capacity` matches during a search.
+ *
+ * Entries are stored inline and compared without calling through a function
+ * pointer: the lowest-ranked entry is the one with the lowest score or, among
+ * equal scores, the path which sorts last (see `store_compare()`).
  */
 
-typedef int (*heap_compare_entries)(const void *a, const void *b);
+#include <stdint.h> /* for uint32_t */
+#include "store.h" /* for store_t */
+
+typedef struct {
+    float score;
+    uint32_t index;
+} topk_entry_t;
 
 typedef struct {
     long count;
     long capacity;
-    void **entries;
-    heap_compare_entries comparator;
-} heap_t;
+    topk_entry_t *entries;
+    const store_t *store; // For breaking ties between equal scores.
+} topk_t;
+
+#define TOPK_PEEK(heap) ((heap)->entries[0])
 
-#define HEAP_PEEK(heap) (heap->entries[0])
+// Returns 1 if `a` ranks below `b`.
+static inline int topk_below(
+    const topk_t *heap,
+    const topk_entry_t *a,
+    const topk_entry_t *b
+) {
+    if (a->score != b->score) {
+        return a->score < b->score;
+    }
+    return store_compare(heap->store, a->index, b->index) > 0;
+}
 
-heap_t *heap_new(long capacity, heap_compare_entries comparator);
-void heap_free(heap_t *heap);
-void heap_insert(heap_t *heap, void *value);
-void *heap_extract(heap_t *heap);
+topk_t *topk_new(long capacity, const store_t *store);
+void topk_free(topk_t *heap);
+void topk_insert(topk_t *heap, float score, uint32_t index);
+void topk_replace_top(topk_t *heap, float score, uint32_t index);
+topk_entry_t topk_extract(topk_t *heap);
@@ -1,243 +1,325 @@
 // Copyright 2010-present Greg Hurrell. All rights reserved.
 // Licensed under the terms of the BSD 2-clause license.
 
-#include <float.h> /* for FLT_MAX */
+#include <string.h> /* for memset() */
+
 #include "match.h"
+#include "prescan.h"
+#include "utf8.h"
 #include "ext.h"
 #include "ruby_compat.h"
 
-#define UNSET_SCORE FLT_MAX
-
 // Use a struct to make passing params during recursion easier.
 typedef struct {
-    char    *haystack_p;            // Pointer to the path string to be searched.
-    long    haystack_len;           // Length of same.
-    char    *needle_p;              // Pointer to search string (needle).
-    long    needle_len;             // Length of same.
+    const char *haystack_p;         // Pointer to the path string to be searched.
+    long    haystack_len;           // Length of same (in characters).
+    const uint32_t *haystack_w;     // Haystack codepoints (UTF-8 mode only).
+    const uint32_t *folded_w;       // Same, folded for comparison.
+    const char *needle_p;           // Pointer to search string (needle).
+    long    needle_len;             // Length of same (in characters).
+    const uint32_t *needle_w;       // Needle codepoints (UTF-8 mode only).
+    const unsigned char *fold;      // Folds haystack bytes for comparison.
+    const unsigned char *boundaries; // Boundary classes (see match.h).
     long    *rightmost_match_p;     // Rightmost match for each char in needle.
     float   max_score_per_char;
-    int     always_show_dot_files;  // Boolean.
-    int     never_show_dot_files;   // Boolean.
-    int     case_sensitive;         // Boolean.
-    int     recurse;                // Boolean.
-    float   *memo;                  // Memoization.
+    memo_cell_t *memo;              // Memoization.
+    uint32_t generation;            // Generation of valid memo cells.
+    float   *row_scores;            // Score on entering each needle row.
 } matchinfo_t;
 
-float recursive_match(
-    matchinfo_t *m,    // Sharable meta-data.
-    long haystack_idx, // Where in the path string to start.
-    long needle_idx,   // Where in the needle string to start.
-    long last_idx,     // Location of last matched character.
-    float score        // Cumulative score so far.
+// Records `score` in the memo `cell`, returning the score.
+static inline float memoize(matchinfo_t *m, memo_cell_t *cell, float score) {
+    cell->score = score;
+    cell->generation = m->generation;
+    return score;
+}
+
+// Returns the boundary class of a haystack character `curr`, given the
+// character `last` that precedes it.
+static inline int boundary_class(uint32_t last, uint32_t curr) {
+    if (last == '/') {
+        return BOUNDARY_SLASH;
+    } else if (
+        last == '-' ||
+        last == '_' ||
+        last == ' ' ||
+        (last >= '0' && last <= '9')
+    ) {
+        return BOUNDARY_SEPARATOR;
+    } else if (
+        last >= 'a' && last <= 'z' &&
+        curr >= 'A' && curr <= 'Z'
+    ) {
+        return BOUNDARY_SEPARATOR; // camelCase.
+    } else if (last == '.') {
+        return BOUNDARY_DOT;
+    }
+    return BOUNDARY_NONE;
+}
+
+// Returns the score contribution of matching the character at `haystack_idx`,
+// given that the previous match was at `last_idx`.
+static inline float calculate_score_for_char(
+    matchinfo_t *m,
+    long haystack_idx,
+    long last_idx
 ) {
-    long distance, i, j;
-    float *memoized = NULL;
-    float score_for_char;
-    float seen_score = 0;
-
-    // Iterate over needle.
-    for (i = needle_idx; i < m->needle_len; i++) {
-        // Iterate over (valid range of) haystack.
-        for (j = haystack_idx; j <= m->rightmost_match_p[i]; j++) {
-            char c, d;
-
-            // Do we have a memoized result we can return?
-            memoized = &m->memo[j * m->needle_len + i];
-            if (*memoized != UNSET_SCORE) {
-                return *memoized > seen_score ? *memoized : seen_score;
-            }
-            c = m->needle_p[i];
-            d = m->haystack_p[j];
-            if (d == '.') {
-                if (j == 0 || m->haystack_p[j - 1] == '/') { // This is a dot-file.
-                    int dot_search = c == '.'; // Searching for a dot.
-                    if (
-                        m->never_show_dot_files ||
-                        (!dot_search && !m->always_show_dot_files)
-                    ) {
-                        return *memoized = 0.0;
-                    }
-                }
-            } else if (d >= 'A' && d <= 'Z' && !m->case_sensitive) {
-                d += 'a' - 'A'; // Add 32 to downcase.
-            }
+    float score_for_char = m->max_score_per_char;
+    long distance = haystack_idx - last_idx;
+
+    if (distance > 1) {
+        static const float boundary_factors[] = {
+            0.0, // BOUNDARY_NONE (see below).
+            0.9, // BOUNDARY_SLASH
+            0.8, // BOUNDARY_SEPARATOR
+            0.7  // BOUNDARY_DOT
+        };
+        int boundary = BOUNDARY_AT(m->boundaries, haystack_idx);
+        float factor;
+        if (boundary != BOUNDARY_NONE) {
+            factor = boundary_factors[boundary];
+        } else {
+            // If no "special" chars behind char, factor diminishes
+            // as distance from last matched char increases.
+            factor = (1.0 / distance) * 0.75;
+        }
+        score_for_char *= factor;
+    }
+    return score_for_char;
+}
+
+// Dot-file policies.
+#define MATCH_DOTS_DEFAULT 0 // Only show dot-files when searching for a dot.
+#define MATCH_DOTS_ALWAYS 1
+#define MATCH_DOTS_NEVER 2
+
+typedef float (*best_score_t)(
+    matchinfo_t *m,
+    scratch_t *scratch,
+    int iterative,
+    long *positions
+);
+typedef best_score_t scorer_table_t[2][3]; // [recurse][dots]
 
-            if (c == d) {
-                // Calculate score.
-                float sub_score = 0;
-                score_for_char = m->max_score_per_char;
-                distance = j - last_idx;
-
-                if (distance > 1) {
-                    float factor = 1.0;
-                    char last = m->haystack_p[j - 1];
-                    char curr = m->haystack_p[j]; // Case matters, so get again.
-                    if (last == '/') {
-                        factor = 0.9;
-                    } else if (
-                        last == '-' ||
-                        last == '_' ||
-                        last == ' ' ||
-                        (last >= '0' && last <= '9')
-                    ) {
-                        factor = 0.8;
-                    } else if (
-                        last >= 'a' && last <= 'z' &&
-                        curr >= 'A' && curr <= 'Z'
-                    ) {
-                        factor = 0.8;
-                    } else if (last == '.') {
-                        factor = 0.7;
-                    } else {
-                        // If no "special" chars behind char, factor diminishes
-                        // as distance from last matched char increases.
-                        factor = (1.0 / distance) * 0.75;
-                    }
-                    score_for_char *= factor;
-                }
-
-                if (j < m->rightmost_match_p[i] && m->recurse) {
-                    sub_score = recursive_match(m, j + 1, i, last_idx, score);
-                    if (sub_score > seen_score) {
-                        seen_score = sub_score;
-                    }
-                }
-                last_idx = j;
-                haystack_idx = last_idx + 1;
-                score += score_for_char;
-                *memoized = seen_score > score ? seen_score : score;
-                if (i == m->needle_len - 1) {
-                    // Whole string matched.
-                    return *memoized;
-                }
-                if (!m->recurse) {
-                    break;
-                }
+// Byte-wise scoring: the fast path, for ASCII haystacks and needles.
+#define MATCH_CHAR_T char
+#define HAYSTACK_AT(m, idx) ((m)->haystack_p[idx])
+#define NEEDLE_AT(m, idx) ((m)->needle_p[idx])
+#define FOLDED_AT(m, idx) ((char)(m)->fold[(unsigned char)(m)->haystack_p[idx]])
+#define MATCH_PREFIX ci_
+#include "match_variants.h"
+#undef MATCH_PREFIX
+#undef FOLDED_AT
+#define FOLDED_AT(m, idx) HAYSTACK_AT(m, idx)
+#define MATCH_PREFIX cs_
+#include "match_variants.h"
+#undef MATCH_PREFIX
+#undef FOLDED_AT
+#undef MATCH_CHAR_T
+#undef HAYSTACK_AT
+#undef NEEDLE_AT
+
+// Codepoint-wise scoring, for everything else. Haystacks are folded (or not)
+// as they are decoded, so there is no need for separate case-sensitive
+// variants.
+#define MATCH_CHAR_T uint32_t
+#define HAYSTACK_AT(m, idx) ((m)->haystack_w[idx])
+#define FOLDED_AT(m, idx) ((m)->folded_w[idx])
+#define NEEDLE_AT(m, idx) ((m)->needle_w[idx])
+#define MATCH_PREFIX utf8_
+#include "match_variants.h"
+#undef MATCH_PREFIX
+#undef MATCH_CHAR_T
+#undef HAYSTACK_AT
+#undef FOLDED_AT
+#undef NEEDLE_AT
+
+// Returns the bitmask of character classes (see `bitmask_for_char()`) present
+// in the `len` bytes at `p`, setting `flags` appropriately.
+//
+// The bitmask of a non-ASCII haystack also covers the case folding of each
+// codepoint, because some (eg. U+212A KELVIN SIGN) fold to ASCII.
+uint64_t calculate_bitmask(const char *p, long len, uint32_t *flags) {
+    long i;
+    uint64_t mask = 0;
+    unsigned char high = 0;
+
+    *flags = 0;
+    for (i = 0; i < len; i++) {
+        mask |= bitmask_for_char(p[i]);
+        high |= p[i];
+        if (p[i] == '.' && (i == 0 || p[i - 1] == '/')) {
+            *flags |= MATCH_DOT_FILE;
+        }
+    }
+    if (high & 0x80) {
+        *flags |= MATCH_NON_ASCII;
+        for (i = 0; i < len; ) {
+            uint32_t codepoint;
+            i += utf8_decode(p + i, len - i, &codepoint);
+            codepoint = utf8_fold(codepoint);
+            if (codepoint < 0x80) {
+                mask |= bitmask_for_char(codepoint);
             }
         }
     }
-    return *memoized = score;
+    return mask;
+}
+
+// Fills in the boundary classes of each character of the `len` bytes at `p`
+// (see `BOUNDARY_AT()`); `haystack_flags` must already be known.
+void calculate_boundaries(
+    const char *p,
+    long len,
+    uint32_t haystack_flags,
+    unsigned char *boundaries
+) {
+    long i, idx;
+    uint32_t last = 0;
+
+    memset(boundaries, 0, BOUNDARY_BYTES(len));
+    for (i = 0, idx = 0; i < len; idx++) {
+        uint32_t curr;
+        if (haystack_flags & MATCH_NON_ASCII) {
+            i += utf8_decode(p + i, len - i, &curr);
+        } else {
+            curr = (unsigned char)p[i++];
+        }
+        boundaries[idx / 4] |= boundary_class(last, curr) << (idx % 4 * 2);
+        last = curr;
+    }
+}
+
+// Scores the haystack described by `m` codepoint-wise.
+static float utf8_calculate_match(
+    matchinfo_t *m,
+    const needle_t *needle,
+    best_score_t best_score,
+    scratch_t *scratch,
+    int iterative,
+    long *positions
+) {
+    long i, needle_idx;
+    long haystack_len = 0;
+    uint32_t *haystack_w, *folded_w;
+    float score;
+
+    if (!scratch_reserve_haystack(scratch, m->haystack_len)) {
+        return 0.0;
+    }
+    haystack_w = scratch->haystack_w;
+    folded_w = scratch->folded_w;
+    for (i = 0; i < m->haystack_len; haystack_len++) {
+        scratch->offsets[haystack_len] = i;
+        i += utf8_decode(
+            m->haystack_p + i,
+            m->haystack_len - i,
+            &haystack_w[haystack_len]
+        );
+        folded_w[haystack_len] = needle->case_sensitive ?
+            haystack_w[haystack_len] :
+            utf8_fold(haystack_w[haystack_len]);
+    }
+    m->haystack_w = haystack_w;
+    m->folded_w = folded_w;
+    m->haystack_len = haystack_len;
+    m->needle_w = needle->codepoints;
+    m->needle_len = needle->codepoint_length;
+    m->max_score_per_char = (1.0 / haystack_len + needle->inverse_length) / 2;
+
+    // Pre-scan (see `calculate_match()`).
+    needle_idx = m->needle_len - 1;
+    for (i = haystack_len - 1; i >= 0 && needle_idx >= 0; i--) {
+        if (folded_w[i] == m->needle_w[needle_idx]) {
+            m->rightmost_match_p[needle_idx--] = i;
+        }
+    }
+    if (needle_idx != -1) {
+        return 0.0;
+    }
+
+    score = best_score(m, scratch, iterative, positions);
+    if (positions && score > 0.0) {
+        // Report byte offsets, as the byte-wise scorer does.
+        for (i = 0; i < m->needle_len; i++) {
+            positions[i] = scratch->offsets[positions[i]];
+        }
+    }
+    return score;
 }
 
 float calculate_match(
-    VALUE haystack,
-    VALUE needle,
-    VALUE case_sensitive,
+    const char *haystack_p,
+    long haystack_len,
+    const needle_t *needle,
     VALUE always_show_dot_files,
     VALUE never_show_dot_files,
     VALUE recurse,
-    long needle_bitmask,
-    long *haystack_bitmask
+    int iterative,
+    uint32_t haystack_flags,
+    const unsigned char *boundaries,
+    scratch_t *scratch,
+    long *positions
 ) {
     matchinfo_t m;
-    long i;
+    int always              = always_show_dot_files == Qtrue;
+    int never               = never_show_dot_files == Qtrue;
+    int dots                = never ? MATCH_DOTS_NEVER :
+                              always ? MATCH_DOTS_ALWAYS :
+                              MATCH_DOTS_DEFAULT;
     float score             = 1.0;
-    int compute_bitmasks    = *haystack_bitmask == UNSET_BITMASK;
-    m.haystack_p            = RSTRING_PTR(haystack);
-    m.haystack_len          = RSTRING_LEN(haystack);
-    m.needle_p              = RSTRING_PTR(needle);
-    m.needle_len            = RSTRING_LEN(needle);
+    m.haystack_p            = haystack_p;
+    m.haystack_len          = haystack_len;
+    m.needle_p              = needle->bytes;
+    m.needle_len            = needle->length;
+    m.fold                  = needle->fold;
+    m.boundaries            = boundaries;
     m.rightmost_match_p     = NULL;
-    m.max_score_per_char    = (1.0 / m.haystack_len + 1.0 / m.needle_len) / 2;
-    m.always_show_dot_files = always_show_dot_files == Qtrue;
-    m.never_show_dot_files  = never_show_dot_files == Qtrue;
-    m.case_sensitive        = (int)case_sensitive;
-    m.recurse               = recurse == Qtrue;
+    m.max_score_per_char    = (1.0 / m.haystack_len + needle->inverse_length) / 2;
 
     // Special case for zero-length search string.
     if (m.needle_len == 0) {
         // Filter out dot files.
-        if (m.never_show_dot_files || !m.always_show_dot_files) {
-            for (i = 0; i < m.haystack_len; i++) {
-                char c = m.haystack_p[i];
-                if (c == '.' && (i == 0 || m.haystack_p[i - 1] == '/')) {
-                    return -1.0;
-                }
-            }
+        if ((never || !always) && (haystack_flags & MATCH_DOT_FILE)) {
+            return -1.0;
         }
     } else {
-        long haystack_limit;
-        long memo_size;
-        long needle_idx;
-        long mask;
-        long rightmost_match_p[m.needle_len];
-
-        if (*haystack_bitmask != UNSET_BITMASK) {
-            if ((needle_bitmask & *haystack_bitmask) != needle_bitmask) {
-                return 0.0;
-            }
+        if (!scratch_reserve_needle(scratch, needle->codepoint_length)) {
+            return 0.0;
         }
+        m.rightmost_match_p = scratch->rightmost_match_p;
+        m.row_scores = scratch->row_scores;
 
-        // Pre-scan string:
-        // - Bail if it can't match at all.
-        // - Record rightmost match for each character (prune search space).
-        // - Record bitmask for haystack to speed up future searches.
-        m.rightmost_match_p = rightmost_match_p;
-        needle_idx = m.needle_len - 1;
-        mask = 0;
-        for (i = m.haystack_len - 1; i >= 0; i--) {
-            char c = m.haystack_p[i];
-            char lower = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
-            if (!m.case_sensitive) {
-                c = lower;
-            }
-            if (compute_bitmasks) {
-                mask |= (1 << (lower - 'a'));
-            }
-
-            if (needle_idx >= 0) {
-                char d = m.needle_p[needle_idx];
-                if (c == d) {
-                    rightmost_match_p[needle_idx] = i;
-                    needle_idx--;
-                }
-            }
-        }
-        if (compute_bitmasks) {
-            *haystack_bitmask = mask;
-        }
-        if (needle_idx != -1) {
+        if (haystack_flags & MATCH_NON_ASCII) {
+            return utf8_calculate_match(
+                &m,
+                needle,
+                utf8_scorers[recurse == Qtrue][dots],
+                scratch,
+                iterative,
+                positions
+            );
+        } else if (!needle->ascii) {
+            // An ASCII haystack can't contain non-ASCII needle characters.
             return 0.0;
         }
 
-        // Prepare for memoization.
-        haystack_limit = rightmost_match_p[m.needle_len - 1] + 1;
-        memo_size = m.needle_len * haystack_limit;
-        {
-            float memo[memo_size];
-            for (i = 0; i < memo_size; i++) {
-                memo[i] = UNSET_SCORE;
-            }
-            m.memo = memo;
-            score = recursive_match(&m, 0, 0, 0, 0.0);
-
-#ifdef DEBUG
-            fprintf(stdout, "   ");
-            for (i = 0; i < m.needle_len; i++) {
-                fprintf(stdout, "    %c   ", m.needle_p[i]);
-            }
-            fprintf(stdout, "\n");
-            for (i = 0; i < memo_size; i++) {
-                char formatted[8];
-                if (i % m.needle_len == 0) {
-                    long haystack_idx = i / m.needle_len;
-                    fprintf(stdout, "%c: ", m.haystack_p[haystack_idx]);
-                }
-                if (memo[i] == UNSET_SCORE) {
-                    snprintf(formatted, sizeof(formatted), "    -  ");
-                } else {
-                    snprintf(formatted, sizeof(formatted), " %-.4f", memo[i]);
-                }
-                fprintf(stdout, "%s", formatted);
-                if ((i + 1) % m.needle_len == 0) {
-                    fprintf(stdout, "\n");
-                } else {
-                    fprintf(stdout, " ");
-                }
-            }
-            fprintf(stdout, "Final score: %f\n\n", score);
-#endif
+        // Pre-scan string (using the kernel picked by `prescan_init()`; the
+        // haystack bitmask is computed separately, see `prepare_path()`):
+        // - Bail if it can't match at all.
+        // - Record rightmost match for each character (prune search space).
+        if (!prescan(
+            m.haystack_p,
+            m.haystack_len,
+            m.needle_p,
+            m.needle_len,
+            needle->case_sensitive,
+            m.rightmost_match_p
+        )) {
+            return 0.0;
         }
+        score = (needle->case_sensitive ? cs_scorers : ci_scorers)
+            [recurse == Qtrue][dots](&m, scratch, iterative, positions);
     }
     return score;
 }
@@ -1,24 +1,86 @@
 // Copyright 2010-present Greg Hurrell. All rights reserved.
 // Licensed under the terms of the BSD 2-clause license.
 
+#include <float.h>  /* for FLT_EPSILON */
 #include <ruby.h>
+#include <stdint.h> /* for uint32_t, uint64_t */
+#include "needle.h"
+#include "scratch.h"
 
-#define UNSET_BITMASK (-1)
+// Haystack flags, computed along with the bitmask.
+#define MATCH_NON_ASCII 1 // Haystack is scored codepoint-wise.
+#define MATCH_DOT_FILE 2  // Haystack has a path component starting with ".".
+
+// Classes of boundary preceding each haystack character, for scoring: these
+// are a property of the haystack alone, so they are computed along with the
+// bitmask and packed four to a byte.
+#define BOUNDARY_NONE 0
+#define BOUNDARY_SLASH 1     // After "/".
+#define BOUNDARY_SEPARATOR 2 // After "-", "_", " " or a digit, or camelCase.
+#define BOUNDARY_DOT 3       // After ".".
+#define BOUNDARY_BYTES(len) (((len) + 3) / 4)
+#define BOUNDARY_AT(boundaries, idx) \
+    (((boundaries)[(idx) / 4] >> ((idx) % 4 * 2)) & 3)
 
 // Struct for representing an individual match.
+//
+// Matching runs without the GVL, so the path is referred to by its index in
+// the haystacks array, and by its native copy (see store.h).
 typedef struct {
-    VALUE path;
-    long bitmask;
+    long index;
+    const char *path_p;
+    long path_len;
     float score;
 } match_t;
 
+// Returns the bitmask bit for character class of `c`.
+//
+// Printable ASCII (0x20 to 0x7f) is mapped case-insensitively onto 64 bits:
+// "`", "{", "|", "}", "~" and DEL share bits with "@", "[", "\", "]", "^" and
+// "_", respectively. Other bytes (control characters and non-ASCII) don't
+// have a bit, and so never cause a candidate to be rejected.
+static inline uint64_t bitmask_for_char(char c) {
+    unsigned char u = (unsigned char)c;
+    if (u < 0x20 || u > 0x7f) {
+        return 0;
+    }
+    return (uint64_t)1 << (u >= 0x60 ? u - 0x40 : u - 0x20);
+}
+
+// Returns an upper bound on the score that `calculate_match()` can assign to
+// a haystack of `haystack_len` characters.
+//
+// Every needle character contributes at most `max_score_per_char` (its
+// best-case boundary factor being 1.0), with some slack to allow for the
+// rounding of the scorer's single-precision sums.
+static inline float max_score_for(long haystack_len, const needle_t *needle) {
+    double max_score_per_char =
+        (1.0 / haystack_len + needle->inverse_length) / 2;
+    return needle->length * max_score_per_char *
+        (1.0 + needle->length * FLT_EPSILON);
+}
+
+extern uint64_t calculate_bitmask(
+    const char *haystack_p,
+    long haystack_len,
+    uint32_t *flags
+);
+extern void calculate_boundaries(
+    const char *haystack_p,
+    long haystack_len,
+    uint32_t haystack_flags,
+    unsigned char *boundaries
+);
 extern float calculate_match(
-    VALUE str,
-    VALUE needle,
-    VALUE case_sensitive,
+    const char *haystack_p,
+    long haystack_len,
+    const needle_t *needle,
     VALUE always_show_dot_files,
     VALUE never_show_dot_files,
     VALUE recurse,
-    long needle_bitmask,
-    long *haystack_bitmask
+    int iterative,
+    uint32_t haystack_flags,
+    const unsigned char *boundaries,
+    scratch_t *scratch,
+    long *positions // Optional: receives match positions (NULL to skip).
 );
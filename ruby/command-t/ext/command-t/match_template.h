@@ -0,0 +1,311 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * Scoring functions, instantiated by match.c (via match_variants.h) for each
+ * way of representing haystack and needle characters and each combination of
+ * options, so that the inner loops have no option-dependent branches. The
+ * includer defines:
+ *
+ * - MATCH_FN(name): the name of this instantiation of function `name`.
+ * - MATCH_CHAR_T: the character type.
+ * - HAYSTACK_AT(m, idx): the haystack character at `idx`.
+ * - FOLDED_AT(m, idx): same, folded for comparison with the needle.
+ * - NEEDLE_AT(m, idx): the needle character at `idx`.
+ * - MATCH_RECURSE: 1 to consider all alignments, 0 to match greedily.
+ * - MATCH_DOTS: MATCH_DOTS_DEFAULT, MATCH_DOTS_ALWAYS or MATCH_DOTS_NEVER.
+ */
+
+// Returns 1 if the dot-file at `haystack_idx` (if any) causes the search for
+// needle character `c` to be abandoned.
+static inline int MATCH_FN(hidden_dot_file)(
+    matchinfo_t *m,
+    long haystack_idx,
+    MATCH_CHAR_T c
+) {
+#if MATCH_DOTS == MATCH_DOTS_ALWAYS
+    return 0;
+#else
+    if (
+        HAYSTACK_AT(m, haystack_idx) == '.' &&
+        (haystack_idx == 0 || HAYSTACK_AT(m, haystack_idx - 1) == '/')
+    ) {
+#if MATCH_DOTS == MATCH_DOTS_NEVER
+        return 1;
+#else
+        return c != '.'; // Only shown when searching for a dot.
+#endif
+    }
+    return 0;
+#endif
+}
+
+// Returns 1 if the haystack character at `haystack_idx` matches needle
+// character `c`.
+static inline int MATCH_FN(char_matches)(
+    matchinfo_t *m,
+    long haystack_idx,
+    MATCH_CHAR_T c
+) {
+    return c == FOLDED_AT(m, haystack_idx);
+}
+
+static float MATCH_FN(recursive_match)(
+    matchinfo_t *m,    // Sharable meta-data.
+    long haystack_idx, // Where in the path string to start.
+    long needle_idx,   // Where in the needle string to start.
+    long last_idx,     // Location of last matched character.
+    float score        // Cumulative score so far.
+) {
+    long i, j;
+    memo_cell_t *memoized = NULL;
+    float score_for_char;
+    float seen_score = 0;
+
+    // Iterate over needle.
+    for (i = needle_idx; i < m->needle_len; i++) {
+        // Iterate over (valid range of) haystack.
+        for (j = haystack_idx; j <= m->rightmost_match_p[i]; j++) {
+            MATCH_CHAR_T c, d;
+
+            // Do we have a memoized result we can return?
+            memoized = &m->memo[j * m->needle_len + i];
+            if (memoized->generation == m->generation) {
+                return memoized->score > seen_score ?
+                    memoized->score :
+                    seen_score;
+            }
+            c = NEEDLE_AT(m, i);
+            if (MATCH_FN(hidden_dot_file)(m, j, c)) {
+                return memoize(m, memoized, 0.0);
+            }
+            d = FOLDED_AT(m, j);
+
+            if (c == d) {
+                // Calculate score.
+                float sub_score = 0;
+                score_for_char =
+                    calculate_score_for_char(m, j, last_idx);
+
+                if (MATCH_RECURSE && j < m->rightmost_match_p[i]) {
+                    sub_score =
+                        MATCH_FN(recursive_match)(m, j + 1, i, last_idx, score);
+                    if (sub_score > seen_score) {
+                        seen_score = sub_score;
+                    }
+                }
+                last_idx = j;
+                haystack_idx = last_idx + 1;
+                score += score_for_char;
+                memoize(m, memoized, seen_score > score ? seen_score : score);
+                if (i == m->needle_len - 1) {
+                    // Whole string matched.
+                    return memoized->score;
+                }
+                if (!MATCH_RECURSE) {
+                    break;
+                }
+            }
+        }
+    }
+    return memoize(m, memoized, score);
+}
+
+// Non-recursive equivalent of `recursive_match()`, producing identical scores.
+//
+// In recursive mode, `recursive_match()` only ever carries a full match
+// forward from the rightmost candidate position for each needle character;
+// every other candidate in a row contributes the score accumulated up to that
+// row and is then abandoned (see the memoized early return). So instead of
+// recursing, we compute the cumulative score along the rightmost path, then
+// walk each row's band of the needle x haystack matrix from right to left,
+// carrying the memo value and return value of the next "interesting" cell
+// (match or hidden dot-file) as the only rolling state. Rows are processed
+// bottom-up so that the value of continuing into row `i + 1` is known by the
+// time row `i` needs it.
+//
+// In non-recursive mode, the scorer just takes the leftmost match for each
+// character in turn.
+//
+// If `positions` is not NULL, it is filled with the haystack index used for
+// each needle character by the alignment that produced the score.
+static float MATCH_FN(iterative_match)(matchinfo_t *m, long *positions) {
+    long i, j;
+    long last_idx = 0;
+    float score = 0.0;
+
+    if (!MATCH_RECURSE) {
+        long haystack_idx = 0;
+        for (i = 0; i < m->needle_len; i++) {
+            MATCH_CHAR_T c = NEEDLE_AT(m, i);
+            for (j = haystack_idx; j <= m->rightmost_match_p[i]; j++) {
+                if (MATCH_FN(hidden_dot_file)(m, j, c)) {
+                    return 0.0;
+                }
+                if (MATCH_FN(char_matches)(m, j, c)) {
+                    score += calculate_score_for_char(m, j, last_idx);
+                    last_idx = j;
+                    haystack_idx = j + 1;
+                    if (positions) {
+                        positions[i] = j;
+                    }
+                    break;
+                }
+            }
+        }
+        return score;
+    } else {
+        float *entry_score = m->row_scores; // Score on entering row (rightmost path).
+        float next_row = 0.0;               // Value of continuing into next row.
+        long next_row_source = -1;          // Cell responsible for `next_row`.
+
+        for (i = 0; i < m->needle_len; i++) {
+            entry_score[i] = score;
+            score += calculate_score_for_char(
+                m,
+                m->rightmost_match_p[i],
+                last_idx
+            );
+            last_idx = m->rightmost_match_p[i];
+        }
+
+        // As we go, we track which cell (encoded as `row * haystack_len +
+        // index`, or -1 for none) each value originated from, so that we can
+        // recover the alignment behind the final score.
+        for (i = m->needle_len - 1; i >= 0; i--) {
+            MATCH_CHAR_T c = NEEDLE_AT(m, i);
+            int last_row = i == m->needle_len - 1;
+            long rightmost = m->rightmost_match_p[i];
+            long haystack_idx = i ? m->rightmost_match_p[i - 1] + 1 : 0;
+            float next_memo = 0.0;   // Memo of next interesting cell to the right.
+            float next_return = 0.0; // Return value from next interesting cell.
+            long next_memo_source = -1;
+            long next_return_source = -1;
+
+            last_idx = i ? m->rightmost_match_p[i - 1] : 0;
+            for (j = rightmost; j >= haystack_idx; j--) {
+                float memo, partial;
+                long memo_source, source = i * m->haystack_len + j;
+                if (MATCH_FN(hidden_dot_file)(m, j, c)) {
+                    next_memo = next_return = 0.0;
+                    next_memo_source = next_return_source = -1;
+                    continue;
+                }
+                if (!MATCH_FN(char_matches)(m, j, c)) {
+                    continue;
+                }
+                partial = entry_score[i] +
+                    calculate_score_for_char(m, j, last_idx);
+                if (j == rightmost) {
+                    memo = partial;
+                    memo_source = source;
+                    if (last_row) {
+                        next_return = partial;
+                        next_return_source = source;
+                    } else {
+                        next_return = next_row;
+                        next_return_source = next_row_source;
+                    }
+                } else {
+                    // Skipping this candidate yields `next_return`; taking it
+                    // yields `partial` plus whatever the next cell memoized.
+                    if (next_return > partial) {
+                        memo = next_return;
+                        memo_source = next_return_source;
+                    } else {
+                        memo = partial;
+                        memo_source = source;
+                    }
+                    if (last_row) {
+                        next_return = memo;
+                        next_return_source = memo_source;
+                    } else if (next_memo > next_return) {
+                        next_return = next_memo;
+                        next_return_source = next_memo_source;
+                    }
+                }
+                next_memo = memo;
+                next_memo_source = memo_source;
+            }
+            next_row = next_return;
+            next_row_source = next_return_source;
+        }
+        if (positions && next_row_source != -1) {
+            long row = next_row_source / m->haystack_len;
+            for (i = 0; i < row; i++) {
+                positions[i] = m->rightmost_match_p[i];
+            }
+            positions[row] = next_row_source % m->haystack_len;
+
+            // Characters after `row` didn't contribute to the score, so just
+            // place them as far left as possible.
+            j = positions[row] + 1;
+            for (i = row + 1; i < m->needle_len; i++) {
+                while (!MATCH_FN(char_matches)(m, j, NEEDLE_AT(m, i))) {
+                    j++;
+                }
+                positions[i] = j++;
+            }
+        }
+        return next_row;
+    }
+}
+
+// Scores the haystack described by `m`, whose `rightmost_match_p` must already
+// have been filled in by a pre-scan.
+static float MATCH_FN(best_score)(
+    matchinfo_t *m,
+    scratch_t *scratch,
+    int iterative,
+    long *positions
+) {
+    long haystack_limit;
+    long memo_size;
+    float score;
+
+    if (iterative || positions) {
+        return MATCH_FN(iterative_match)(m, positions);
+    }
+
+    // Prepare for memoization.
+    haystack_limit = m->rightmost_match_p[m->needle_len - 1] + 1;
+    memo_size = m->needle_len * haystack_limit;
+    m->memo = scratch_reset_memo(scratch, memo_size);
+    if (!m->memo) {
+        return 0.0;
+    }
+    m->generation = scratch->generation;
+    score = MATCH_FN(recursive_match)(m, 0, 0, 0, 0.0);
+
+#ifdef DEBUG
+    {
+        long i;
+        fprintf(stdout, "   ");
+        for (i = 0; i < m->needle_len; i++) {
+            fprintf(stdout, "    %c   ", (int)NEEDLE_AT(m, i));
+        }
+        fprintf(stdout, "\n");
+        for (i = 0; i < memo_size; i++) {
+            char formatted[8];
+            if (i % m->needle_len == 0) {
+                long haystack_idx = i / m->needle_len;
+                fprintf(stdout, "%c: ", (int)HAYSTACK_AT(m, haystack_idx));
+            }
+            if (m->memo[i].generation != m->generation) {
+                snprintf(formatted, sizeof(formatted), "    -  ");
+            } else {
+                snprintf(formatted, sizeof(formatted), " %-.4f", m->memo[i].score);
+            }
+            fprintf(stdout, "%s", formatted);
+            if ((i + 1) % m->needle_len == 0) {
+                fprintf(stdout, "\n");
+            } else {
+                fprintf(stdout, " ");
+            }
+        }
+        fprintf(stdout, "Final score: %f\n\n", score);
+    }
+#endif
+
+    return score;
+}
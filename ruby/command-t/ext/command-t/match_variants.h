@@ -0,0 +1,66 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * Instantiates match_template.h for each combination of MATCH_RECURSE and
+ * MATCH_DOTS, and collects the resulting `best_score()` variants into a
+ * table, `MATCH_PREFIX ## scorers`, indexed by `[recurse][dots]`.
+ *
+ * The includer defines MATCH_PREFIX and the character representation macros
+ * required by match_template.h.
+ */
+
+#define MATCH_PASTE(prefix, name, suffix) prefix ## name ## suffix
+#define MATCH_EXPAND(prefix, name, suffix) MATCH_PASTE(prefix, name, suffix)
+
+#define MATCH_RECURSE 0
+#define MATCH_DOTS MATCH_DOTS_DEFAULT
+#define MATCH_FN(name) MATCH_EXPAND(MATCH_PREFIX, name, _flat_default)
+#include "match_template.h"
+#undef MATCH_DOTS
+#undef MATCH_FN
+#define MATCH_DOTS MATCH_DOTS_ALWAYS
+#define MATCH_FN(name) MATCH_EXPAND(MATCH_PREFIX, name, _flat_always)
+#include "match_template.h"
+#undef MATCH_DOTS
+#undef MATCH_FN
+#define MATCH_DOTS MATCH_DOTS_NEVER
+#define MATCH_FN(name) MATCH_EXPAND(MATCH_PREFIX, name, _flat_never)
+#include "match_template.h"
+#undef MATCH_DOTS
+#undef MATCH_FN
+#undef MATCH_RECURSE
+
+#define MATCH_RECURSE 1
+#define MATCH_DOTS MATCH_DOTS_DEFAULT
+#define MATCH_FN(name) MATCH_EXPAND(MATCH_PREFIX, name, _recurse_default)
+#include "match_template.h"
+#undef MATCH_DOTS
+#undef MATCH_FN
+#define MATCH_DOTS MATCH_DOTS_ALWAYS
+#define MATCH_FN(name) MATCH_EXPAND(MATCH_PREFIX, name, _recurse_always)
+#include "match_template.h"
+#undef MATCH_DOTS
+#undef MATCH_FN
+#define MATCH_DOTS MATCH_DOTS_NEVER
+#define MATCH_FN(name) MATCH_EXPAND(MATCH_PREFIX, name, _recurse_never)
+#include "match_template.h"
+#undef MATCH_DOTS
+#undef MATCH_FN
+#undef MATCH_RECURSE
+
+static const scorer_table_t MATCH_EXPAND(MATCH_PREFIX, scorers, ) = {
+    {
+        MATCH_EXPAND(MATCH_PREFIX, best_score, _flat_default),
+        MATCH_EXPAND(MATCH_PREFIX, best_score, _flat_always),
+        MATCH_EXPAND(MATCH_PREFIX, best_score, _flat_never)
+    },
+    {
+        MATCH_EXPAND(MATCH_PREFIX, best_score, _recurse_default),
+        MATCH_EXPAND(MATCH_PREFIX, best_score, _recurse_always),
+        MATCH_EXPAND(MATCH_PREFIX, best_score, _recurse_never)
+    }
+};
+
+#undef MATCH_PASTE
+#undef MATCH_EXPAND
@@ -2,64 +2,80 @@
 // Licensed under the terms of the BSD 2-clause license.
 
 #include <stdlib.h>  /* for qsort() */
-#include <string.h>  /* for strncmp() */
+#include <string.h>  /* for memcpy() */
+#include <sys/time.h> /* for gettimeofday() */
+#include <time.h>    /* for clock_gettime() */
 #include "match.h"
 #include "matcher.h"
-#include "heap.h"
+#include "heap.h" /* also includes store.h */
 #include "ext.h"
+#include "pool.h"
+#include "radix.h"
+#include "survivors.h"
 #include "ruby_compat.h"
 
-// order matters; we want this to be evaluated only after ruby.h
-#ifdef HAVE_PTHREAD_H
-#include <pthread.h> /* for pthread_create, pthread_join etc */
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h> /* for rb_thread_call_without_gvl2() */
 #endif
 
 // Comparison function for use with qsort.
+//
+// Orders paths lexicographically, as `store_compare()` does (see store.h).
 int cmp_alpha(const void *a, const void *b) {
-    match_t a_match = *(match_t *)a;
-    match_t b_match = *(match_t *)b;
-    VALUE   a_str   = a_match.path;
-    VALUE   b_str   = b_match.path;
-    char    *a_p    = RSTRING_PTR(a_str);
-    long    a_len   = RSTRING_LEN(a_str);
-    char    *b_p    = RSTRING_PTR(b_str);
-    long    b_len   = RSTRING_LEN(b_str);
-    int     order   = 0;
-
-    if (a_len > b_len) {
-        order = strncmp(a_p, b_p, b_len);
-        if (order == 0)
-            order = 1; // shorter string (b) wins.
-    } else if (a_len < b_len) {
-        order = strncmp(a_p, b_p, a_len);
-        if (order == 0)
-            order = -1; // shorter string (a) wins.
-    } else {
-        order = strncmp(a_p, b_p, a_len);
-    }
+    const match_t *a_match = (const match_t *)a;
+    const match_t *b_match = (const match_t *)b;
+    long a_len = a_match->path_len;
+    long b_len = b_match->path_len;
+    int order = memcmp(
+        a_match->path_p,
+        b_match->path_p,
+        a_len < b_len ? a_len : b_len
+    );
 
+    if (order == 0) {
+        // Shorter string wins.
+        order = a_len < b_len ? -1 : a_len > b_len;
+    }
+    if (order == 0) {
+        order = a_match->index < b_match->index ? -1 :
+            a_match->index > b_match->index;
+    }
     return order;
 }
 
 // Comparison function for use with qsort.
 int cmp_score(const void *a, const void *b) {
-    match_t a_match = *(match_t *)a;
-    match_t b_match = *(match_t *)b;
+    const match_t *a_match = (const match_t *)a;
+    const match_t *b_match = (const match_t *)b;
 
-    if (a_match.score > b_match.score) {
+    if (a_match->score > b_match->score) {
         return -1; // a scores higher, a should appear sooner.
-    } else if (a_match.score < b_match.score) {
+    } else if (a_match->score < b_match->score) {
         return 1;  // b scores higher, a should appear later.
     } else {
         return cmp_alpha(a, b);
     }
 }
 
+// Default number of survivor lists to keep (see survivors.h).
+#define SURVIVOR_DEPTH 16
+
+// Default number of result lists to keep (see `cache_for()`).
+#define CACHE_SIZE 32
+
+// Limits from this one up are met by scoring every candidate and then picking
+// out the top matches (see `select_keys()`), rather than with per-thread
+// heaps: the heaps get slower as they grow, and break even with selection at
+// around this size (on a set of ~500k paths).
+#define SELECT_LIMIT 10000
+
 VALUE CommandTMatcher_initialize(int argc, VALUE *argv, VALUE self) {
     VALUE always_show_dot_files;
+    VALUE cache_size;
     VALUE never_show_dot_files;
     VALUE options;
     VALUE scanner;
+    VALUE survivor_depth;
 
     // Process arguments: 1 mandatory, 1 optional.
     if (rb_scan_args(argc, argv, "11", &scanner, &options) == 1) {
@@ -78,128 +94,1101 @@ VALUE CommandTMatcher_initialize(int argc, VALUE *argv, VALUE self) {
     rb_iv_set(self, "@always_show_dot_files", always_show_dot_files);
     rb_iv_set(self, "@never_show_dot_files", never_show_dot_files);
 
+    // Each survivor list takes up to 4 bytes per path.
+    survivor_depth = CommandT_option_from_hash("survivor_depth", options);
+    if (NIL_P(survivor_depth)) {
+        survivor_depth = LONG2NUM(SURVIVOR_DEPTH);
+    } else if (NUM2LONG(survivor_depth) < 0) {
+        rb_raise(rb_eArgError, "negative survivor_depth");
+    }
+    rb_iv_set(self, "@survivor_depth", survivor_depth);
+
+    cache_size = CommandT_option_from_hash("cache_size", options);
+    if (NIL_P(cache_size)) {
+        cache_size = LONG2NUM(CACHE_SIZE);
+    } else if (NUM2LONG(cache_size) < 0) {
+        rb_raise(rb_eArgError, "negative cache_size");
+    }
+    rb_iv_set(self, "@cache_size", cache_size);
+    rb_iv_set(self, "@cache_hits", LONG2NUM(0));
+    rb_iv_set(self, "@cache_misses", LONG2NUM(0));
+
     return Qnil;
 }
 
+// Score recorded for candidates that were skipped because they couldn't make it
+// into the top `limit`; being non-zero, it stops subsequent searches from
+// skipping them as non-matches.
+#define PRUNED_SCORE -1.0
+
+// Score recorded for candidates with a dot-file component which didn't match.
+// Whether the dot-file rules hide a path depends on the whole needle (eg. on
+// which positions the scan visits, and on whether it is looking for a "."), so
+// unlike a path which doesn't contain the needle at all, such a path isn't
+// known to be ruled out for every needle which extends this one; being
+// non-zero, this keeps it in the survivor list.
+#define HIDDEN_SCORE -2.0
+
+// Fills in `match` for the path at `index` in `store`.
+static inline void match_init(match_t *match, store_t *store, long index) {
+    match->index = index;
+    match->path_p = STORE_PATH(store, index);
+    match->path_len = store->lengths[index];
+    match->score = store->scores[index];
+}
+
+// Paths are handed out to threads in chunks whose size is a multiple of
+// CHUNK_MIN. When the whole store is scanned, this means (given
+// cache-line-aligned arrays in the store) that no two threads write to the
+// same cache line; survivors of an earlier search are scattered across the
+// store, so there it only bounds the cost of claiming chunks.
+#define CHUNK_MIN 64
+#define CHUNK_MAX 4096
+
+#if defined(__GNUC__) || defined(__clang__)
+// Claims the next chunk from the shared cursor, returning its start.
+#define NEXT_CHUNK(args) __sync_fetch_and_add((args)->cursor, (args)->chunk_size)
+#else
+// No atomics: deal the chunks out to threads in turn.
+#define NEXT_CHUNK(args) \
+    (((args)->chunks * (args)->thread_count + (args)->thread_index) * \
+     (args)->chunk_size)
+#endif
+
+// Returns a monotonic timestamp, in seconds.
+static double now(void) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
 typedef struct {
     long thread_count;
     long thread_index;
-    long case_sensitive;
+    long *cursor;    // Start of the next unclaimed chunk.
+    long chunk_size;
     long limit;
-    match_t *matches;
-    long path_count;
-    VALUE haystacks;
-    VALUE needle;
-    VALUE last_needle;
+    store_t *store;
+    const needle_t *needle;
+    const uint32_t *candidates; // Indices of paths to look at (NULL for all).
+    long candidate_count;
     VALUE always_show_dot_files;
     VALUE never_show_dot_files;
     VALUE recurse;
-    long needle_bitmask;
+    int iterative;
+    int compute_bitmasks;
+    scratch_t *scratch;
+    volatile int *interrupted;
+    volatile unsigned long *generation; // See `generation_for()`.
+    unsigned long search_generation;    // Value of `*generation` at start.
+    volatile int *pausing; // Set to make all threads pause (see `search_t`).
+    double pause_time;     // Pause once `now()` reaches this (if non-zero).
+    long pause_paths;      // Pause once `paths` reaches this (if non-zero).
+
+    // Kept across pauses.
+    topk_t *heap;    // Top `limit` matches so far (NULL if not yet created).
+
+    // Filled in by `sort_thread()`.
+    match_t *run;    // Storage for `limit` matches.
+    long run_length;
+
+    // Statistics, filled in by the thread.
+    long chunks;
+    long paths;
+    double busy;     // Seconds spent matching.
 } thread_args_t;
 
-void *match_thread(void *thread_args) {
+// Fills in the bitmask, flags and boundary classes of path `i`.
+static inline void prepare_path(store_t *store, long i) {
+    store->bitmasks[i] = calculate_bitmask(
+        STORE_PATH(store, i),
+        store->lengths[i],
+        &store->flags[i]
+    );
+    calculate_boundaries(
+        STORE_PATH(store, i),
+        store->lengths[i],
+        store->flags[i],
+        STORE_BOUNDARIES(store, i)
+    );
+}
+
+// Prepares every path in the store, for searches which don't otherwise visit
+// them all (see `alphabetic_search()`).
+void *prepare_thread(void *thread_args) {
+    long i, start, end;
+    thread_args_t *args = (thread_args_t *)thread_args;
+    store_t *store = args->store;
+    double started = now();
+
+    for (;;) {
+        start = NEXT_CHUNK(args);
+        if (start >= store->count) {
+            break;
+        }
+        end = start + args->chunk_size;
+        if (end > store->count) {
+            end = store->count;
+        }
+        args->chunks++;
+        args->paths += end - start;
+        for (i = start; i < end; i++) {
+            prepare_path(store, i);
+        }
+    }
+
+    args->busy += now() - started;
+    return NULL;
+}
+
+// Sorts this thread's part of the store (see `store_rank_part()`).
+void *rank_thread(void *thread_args) {
+    thread_args_t *args = (thread_args_t *)thread_args;
+    double started = now();
+
+    store_rank_part(args->store, args->thread_index, args->thread_count);
+    args->busy += now() - started;
+    return NULL;
+}
+
+// Frees the heaps of the `count` threads described by `args`.
+void free_heaps(thread_args_t *args, long count) {
     long i;
-    float score;
-    heap_t *heap = NULL;
+    for (i = 0; i < count; i++) {
+        if (args[i].heap) {
+            topk_free(args[i].heap);
+            args[i].heap = NULL;
+        }
+    }
+}
+
+void *match_thread(void *thread_args) {
+    long i, j, start, end;
+    long haystack_len;
+    topk_t *heap;
+    topk_entry_t entry;
     thread_args_t *args = (thread_args_t *)thread_args;
+    store_t *store = args->store;
+    uint64_t needle_bitmask = args->needle->bitmask;
+    double started = now();
 
-    if (args->limit) {
-        // Reserve one extra slot so that we can do an insert-then-extract even
-        // when "full" (effectively allows use of min-heap to maintain a
-        // top-"limit" list of items).
-        heap = heap_new(args->limit + 1, cmp_score);
+    if (args->limit && !args->heap) {
+        args->heap = topk_new(args->limit, store);
+        if (!args->heap) {
+            args->scratch->failed = 1;
+            return NULL;
+        }
     }
+    heap = args->heap;
 
-    for (
-        i = args->thread_index;
-        i < args->path_count;
-        i += args->thread_count
-    ) {
-        args->matches[i].path = RARRAY_PTR(args->haystacks)[i];
-        if (args->needle_bitmask == UNSET_BITMASK) {
-            args->matches[i].bitmask = UNSET_BITMASK;
+    for (;;) {
+        // Check before claiming a chunk, so that after stopping early, the
+        // search can carry on from where it left off.
+        if (
+            *args->interrupted ||
+            *args->pausing ||
+            *args->generation != args->search_generation
+        ) {
+            break;
         }
-        if (!NIL_P(args->last_needle) && args->matches[i].score == 0.0) {
-            // Skip over this candidate because it didn't match last
-            // time and it can't match this time either.
-            continue;
+        start = NEXT_CHUNK(args);
+        if (start >= args->candidate_count) {
+            break;
         }
-        args->matches[i].score = calculate_match(
-            args->matches[i].path,
-            args->needle,
-            args->case_sensitive,
-            args->always_show_dot_files,
-            args->never_show_dot_files,
-            args->recurse,
-            args->needle_bitmask,
-            &args->matches[i].bitmask
-        );
-        if (args->matches[i].score == 0.0) {
-            continue;
+        end = start + args->chunk_size;
+        if (end > args->candidate_count) {
+            end = args->candidate_count;
         }
-        if (heap) {
-            if (heap->count == args->limit) {
-                score = ((match_t *)HEAP_PEEK(heap))->score;
-                if (args->matches[i].score >= score) {
-                    heap_insert(heap, &args->matches[i]);
-                    (void)heap_extract(heap);
+        args->chunks++;
+        args->paths += end - start;
+
+        for (j = start; j < end; j++) {
+            i = args->candidates ? (long)args->candidates[j] : j;
+            if (args->compute_bitmasks) {
+                // First search over these paths: prepare them as we go. The
+                // pre-scan in `calculate_match()` doesn't depend on this, so
+                // it is vectorized on this pass too.
+                prepare_path(store, i);
+            }
+            if ((needle_bitmask & store->bitmasks[i]) != needle_bitmask) {
+                // Candidate lacks at least one character class in the needle.
+                store->scores[i] = 0.0;
+                continue;
+            }
+            haystack_len = store->lengths[i];
+            if (store->flags[i] & MATCH_NON_ASCII) {
+                // No more than 4 bytes per character.
+                haystack_len = (haystack_len + 3) / 4;
+            }
+            if (
+                heap &&
+                heap->count == args->limit &&
+                args->needle->length &&
+                max_score_for(haystack_len, args->needle) <
+                    TOPK_PEEK(heap).score
+            ) {
+                store->scores[i] = PRUNED_SCORE;
+                continue;
+            }
+            store->scores[i] = calculate_match(
+                STORE_PATH(store, i),
+                store->lengths[i],
+                args->needle,
+                args->always_show_dot_files,
+                args->never_show_dot_files,
+                args->recurse,
+                args->iterative,
+                store->flags[i],
+                STORE_BOUNDARIES(store, i),
+                args->scratch,
+                NULL
+            );
+            if (store->scores[i] == 0.0) {
+                if (store->flags[i] & MATCH_DOT_FILE) {
+                    store->scores[i] = HIDDEN_SCORE;
                 }
-            } else {
-                heap_insert(heap, &args->matches[i]);
+                continue;
             }
+            if (heap) {
+                if (heap->count < args->limit) {
+                    topk_insert(heap, store->scores[i], i);
+                } else {
+                    entry.score = store->scores[i];
+                    entry.index = i;
+                    if (topk_below(heap, &TOPK_PEEK(heap), &entry)) {
+                        // Evict the lowest entry.
+                        topk_replace_top(heap, entry.score, i);
+                    }
+                }
+            }
+        }
+
+        // Checked only after finishing a chunk, to guarantee progress.
+        if (
+            (args->pause_paths && args->paths >= args->pause_paths) ||
+            (args->pause_time && now() >= args->pause_time)
+        ) {
+            *args->pausing = 1;
+            break;
         }
     }
 
+    args->busy += now() - started;
     return heap;
 }
 
-long calculate_bitmask(VALUE string) {
-    char *str = RSTRING_PTR(string);
-    long len = RSTRING_LEN(string);
+// Empties a thread's heap into its `run`, best match first. Runs after all
+// threads have finished matching, so that each one sorts its own matches.
+void *sort_thread(void *thread_args) {
     long i;
-    long mask = 0;
-    for (i = 0; i < len; i++) {
-        if (str[i] >= 'a' && str[i] <= 'z') {
-            mask |= (1 << (str[i] - 'a'));
-        } else if (str[i] >= 'A' && str[i] <= 'Z') {
-            mask |= (1 << (str[i] - 'A'));
+    thread_args_t *args = (thread_args_t *)thread_args;
+    topk_t *heap = args->heap;
+
+    // The heap yields the lowest-ranked match first.
+    args->run_length = heap ? heap->count : 0;
+    for (i = args->run_length - 1; i >= 0; i--) {
+        match_init(&args->run[i], args->store, topk_extract(heap).index);
+    }
+    return NULL;
+}
+
+// Returns whichever of runs `a` and `b` (either of which may be -1, meaning
+// "none") has the better head, preferring `a` in the event of a tie.
+static inline long merge_winner(
+    thread_args_t *args,
+    long *heads,
+    long a,
+    long b
+) {
+    if (a < 0) {
+        return b;
+    } else if (b < 0) {
+        return a;
+    }
+    return cmp_score(
+        &args[a].run[heads[a]],
+        &args[b].run[heads[b]]
+    ) <= 0 ? a : b;
+}
+
+// Merges the sorted runs of `count` threads into `out`, stopping after
+// `limit` matches, and returns the number written. Uses a tournament tree,
+// so each match costs only log2(count) comparisons. Returns -1 on allocation
+// failure.
+long merge_runs(thread_args_t *args, long count, long limit, match_t *out) {
+    long i, n, run;
+    long size = 1;
+    long *heads;
+    long *tree;
+
+    while (size < count) {
+        size *= 2;
+    }
+    heads = calloc(count, sizeof(long));
+    tree = malloc(2 * size * sizeof(long));
+    if (!heads || !tree) {
+        free(heads);
+        free(tree);
+        return -1;
+    }
+
+    // Leaves are runs (-1 if empty); each parent holds the winner below it.
+    for (i = 0; i < size; i++) {
+        tree[size + i] = i < count && args[i].run_length ? i : -1;
+    }
+    for (i = size - 1; i > 0; i--) {
+        tree[i] = merge_winner(args, heads, tree[2 * i], tree[2 * i + 1]);
+    }
+
+    for (n = 0; n < limit && tree[1] >= 0; n++) {
+        run = tree[1];
+        out[n] = args[run].run[heads[run]++];
+        if (heads[run] == args[run].run_length) {
+            tree[size + run] = -1;
         }
+
+        // Replay the matches on the path from the run's leaf to the root.
+        for (i = (size + run) / 2; i > 0; i /= 2) {
+            tree[i] = merge_winner(args, heads, tree[2 * i], tree[2 * i + 1]);
+        }
+    }
+
+    free(heads);
+    free(tree);
+    return n;
+}
+
+// Frees a NULL-terminated array of scratch arenas.
+void free_scratches(scratch_t **scratches) {
+    scratch_t **scratch;
+    for (scratch = scratches; *scratch; scratch++) {
+        scratch_free(*scratch);
     }
-    return mask;
+    free(scratches);
 }
 
-VALUE CommandTMatcher_sorted_matches_for(int argc, VALUE *argv, VALUE self)
-{
-    long i, j, limit, path_count, thread_count;
+// Returns a NULL-terminated array of (at least) `count` scratch arenas, one
+// per thread, which persist across searches so that their storage can be
+// reused.
+scratch_t **scratches_for(VALUE self, long count) {
+    long i;
+    scratch_t **scratches;
+    VALUE wrapped_scratches = rb_ivar_get(self, rb_intern("scratches"));
+
+    if (NIL_P(wrapped_scratches)) {
+        scratches = calloc(1, sizeof(scratch_t *));
+        if (!scratches) {
+            rb_raise(rb_eNoMemError, "memory allocation failed");
+        }
+        wrapped_scratches = Data_Wrap_Struct(
+            rb_cObject,
+            0,
+            free_scratches,
+            scratches
+        );
+        rb_ivar_set(self, rb_intern("scratches"), wrapped_scratches);
+    } else {
+        Data_Get_Struct(wrapped_scratches, scratch_t *, scratches);
+    }
+
+    for (i = 0; scratches[i]; i++) {
+        scratches[i]->failed = 0;
+    }
+    if (i < count) {
+        scratches = realloc(scratches, (count + 1) * sizeof(scratch_t *));
+        if (!scratches) {
+            rb_raise(rb_eNoMemError, "memory allocation failed");
+        }
+        DATA_PTR(wrapped_scratches) = scratches;
+        for (; i < count; i++) {
+            scratches[i + 1] = NULL;
+            scratches[i] = scratch_new();
+            if (!scratches[i]) {
+                rb_raise(rb_eNoMemError, "memory allocation failed");
+            }
+        }
+    }
+    return scratches;
+}
+
+#ifdef HAVE_PTHREAD_H
+// Returns the worker pool which persists across searches, so that threads are
+// only started once rather than on every keystroke.
+pool_t *pool_for(VALUE self) {
+    pool_t *pool;
+    VALUE wrapped_pool = rb_ivar_get(self, rb_intern("pool"));
+
+    if (NIL_P(wrapped_pool)) {
+        pool = pool_new();
+        if (!pool) {
+            rb_raise(rb_eNoMemError, "memory allocation failed");
+        }
+        wrapped_pool = Data_Wrap_Struct(rb_cObject, 0, pool_free, pool);
+        rb_ivar_set(self, rb_intern("pool"), wrapped_pool);
+    } else {
+        Data_Get_Struct(wrapped_pool, pool_t, pool);
+    }
+    return pool;
+}
+#endif
+
+// Returns the stack of survivor lists which persists across searches (see
+// survivors.h).
+survivor_stack_t *survivor_stack_for(VALUE self) {
+    survivor_stack_t *stack;
+    VALUE wrapped_stack = rb_ivar_get(self, rb_intern("survivors"));
+
+    if (NIL_P(wrapped_stack)) {
+        stack = survivor_stack_new(
+            NUM2LONG(rb_iv_get(self, "@survivor_depth"))
+        );
+        if (!stack) {
+            rb_raise(rb_eNoMemError, "memory allocation failed");
+        }
+        wrapped_stack = Data_Wrap_Struct(
+            rb_cObject,
+            0,
+            survivor_stack_free,
+            stack
+        );
+        rb_ivar_set(self, rb_intern("survivors"), wrapped_stack);
+    } else {
+        Data_Get_Struct(wrapped_stack, survivor_stack_t, stack);
+    }
+    return stack;
+}
+
+// Returns the search generation counter, which is bumped to cancel searches:
+// each search notes its value on starting, and gives up as soon as it sees it
+// change. Only ever written with the GVL held.
+volatile unsigned long *generation_for(VALUE self) {
+    unsigned long *generation;
+    VALUE wrapped_generation = rb_ivar_get(self, rb_intern("generation"));
+
+    if (NIL_P(wrapped_generation)) {
+        generation = malloc(sizeof(unsigned long));
+        if (!generation) {
+            rb_raise(rb_eNoMemError, "memory allocation failed");
+        }
+        *generation = 0;
+        wrapped_generation = Data_Wrap_Struct(rb_cObject, 0, free, generation);
+        rb_ivar_set(self, rb_intern("generation"), wrapped_generation);
+    } else {
+        Data_Get_Struct(wrapped_generation, unsigned long, generation);
+    }
+    return generation;
+}
+
+// Returns the cache of recent results, a Hash whose insertion order doubles as
+// recency order (least recently used first).
+VALUE cache_for(VALUE self) {
+    VALUE cache = rb_ivar_get(self, rb_intern("cache"));
+
+    if (NIL_P(cache)) {
+        cache = rb_hash_new();
+        rb_ivar_set(self, rb_intern("cache"), cache);
+    }
+    return cache;
+}
+
+// Returns a key identifying the results of a search: the compiled needle
+// (already case-folded and stripped of spaces, as appropriate) followed by a
+// fixed-size suffix encoding the options which affect the results.
+VALUE cache_key_for(needle_t *needle, int flags, long limit) {
+    VALUE key = rb_str_new(needle->bytes, needle->length);
+    rb_str_cat(key, (const char *)&flags, sizeof(flags));
+    rb_str_cat(key, (const char *)&limit, sizeof(limit));
+    return key;
+}
+
+// Bumps one of the "@cache_hits" or "@cache_misses" counters.
+void cache_count(VALUE self, const char *counter) {
+    rb_iv_set(self, counter, LONG2NUM(NUM2LONG(rb_iv_get(self, counter)) + 1));
+}
+
+// Returns an array of the byte offsets within the path which `match`
+// describes that the scorer matched against the needle. Offsets are in bytes
+// because paths (eg. from Watchman) are often binary strings, so their
+// characters can only be counted once they're given an encoding for display.
+VALUE positions_for(match_t *match, thread_args_t *args) {
+    long i;
+    long needle_len = args->needle->codepoint_length;
+    long *positions;
+    VALUE positions_buffer;
+    VALUE offsets = rb_ary_new2(needle_len);
+
+    if (needle_len == 0) {
+        return offsets;
+    }
+
+    // Owned by Ruby (or on the stack), so not leaked if `rb_ary_push()` raises.
+    positions = ALLOCV_N(long, positions_buffer, needle_len);
+    if (calculate_match(
+        match->path_p,
+        match->path_len,
+        args->needle,
+        args->always_show_dot_files,
+        args->never_show_dot_files,
+        args->recurse,
+        args->iterative,
+        args->store->flags[match->index],
+        STORE_BOUNDARIES(args->store, match->index),
+        args->scratch,
+        positions
+    ) > 0.0) {
+        for (i = 0; i < needle_len; i++) {
+            rb_ary_push(offsets, LONG2NUM(positions[i]));
+        }
+    }
+    ALLOCV_END(positions_buffer);
+    return offsets;
+}
+
+// State for the part of a search which runs without the GVL.
+typedef struct {
 #ifdef HAVE_PTHREAD_H
-    long err;
-    pthread_t *threads;
+    pool_t *pool;
 #endif
-    long needle_bitmask = UNSET_BITMASK;
-    long heap_matches_count;
+    thread_args_t *thread_args;
+    long thread_count;
+    void **returns;             // Return values of the jobs, one per thread.
+    store_t *store;
+    const uint32_t *candidates; // See `thread_args_t`.
+    long candidate_count;
+    uint32_t *survivors;        // Candidates not ruled out (NULL on failure).
+    long survivor_count;
+    long limit;                 // Maximum number of matches (0 for all).
     int use_heap;
     int sort;
-    match_t *matches;
-    match_t *heap_matches = NULL;
-    heap_t *heap;
+    int alphabetic;             // Boolean: sort by path rather than by score.
+    match_t *sorted_matches;    // Caller-allocated.
+    match_t *merged;            // Caller-allocated, for `merge_runs()`.
+    long sorted_count;
+    long cursor;                // See `NEXT_CHUNK()`.
+    int err;                    // Set if threads couldn't be started.
+    int started;                // Set if the search started.
+    int done;                   // Set if the search ran to completion.
+    int cancelled;              // Set if the search was cancelled.
+    volatile int interrupted;   // Set by `search_unblock()`.
+    volatile int pausing;       // Set when provisional results are due.
+} search_t;
+
+// Frees the buffers of `search`, which can then be released again safely.
+void search_release(search_t *search) {
+    if (search->thread_args) {
+        free_heaps(search->thread_args, search->thread_count);
+    }
+    free(search->thread_args);
+    free(search->returns);
+    free(search->sorted_matches);
+    free(search->merged);
+    free(search->survivors);
+    search->thread_args = NULL;
+    search->returns = NULL;
+    search->sorted_matches = NULL;
+    search->merged = NULL;
+    search->survivors = NULL;
+}
+
+// Frees a search allocated with `Data_Make_Struct()`.
+void search_free(search_t *search) {
+    search_release(search);
+    xfree(search);
+}
+
+// Calls `job` with each thread's arguments, using the pool if there's more
+// than one thread. Returns 0 on success, or an error number.
+int run_threads(search_t *search, void *(*job)(void *)) {
+#ifdef HAVE_PTHREAD_H
+    if (search->thread_count > 1) {
+        return pool_run(
+            search->pool,
+            search->thread_count,
+            job,
+            search->thread_args,
+            sizeof(thread_args_t),
+            search->returns
+        );
+    }
+#endif
+    search->returns[0] = job(&search->thread_args[0]);
+    return 0;
+}
+
+// Ranges of at most this many keys are insertion sorted by `select_keys()`.
+#define SELECT_MIN 16
+
+// Partially sorts `keys` so that the `k` smallest come first, in no
+// particular order.
+//
+// This is introselect: quickselect with median-of-three pivots, which falls
+// back (if partitioning keeps going badly) to a radix sort of whatever is
+// left, rather than the usual heapselect, for a linear worst case.
+void select_keys(uint64_t *keys, long count, long k) {
+    long i, j, n;
+    long lo = 0;
+    long hi = count;
+    int depth = 0;
+    uint64_t a, b, c, pivot, key;
+
+    for (n = count; n > 1; n /= 2) {
+        depth += 2;
+    }
+    while (hi - lo > SELECT_MIN) {
+        if (depth-- == 0 && radix_sort(keys + lo, hi - lo) == 0) {
+            return;
+        }
+        a = keys[lo];
+        b = keys[lo + (hi - lo) / 2];
+        c = keys[hi - 1];
+        pivot = a < b ?
+            (b < c ? b : (a < c ? c : a)) :
+            (a < c ? a : (b < c ? c : b));
+
+        // Hoare partition: afterwards, keys[lo..j] <= pivot <= keys[j+1..hi).
+        i = lo;
+        j = hi - 1;
+        for (;;) {
+            while (keys[i] < pivot) {
+                i++;
+            }
+            while (keys[j] > pivot) {
+                j--;
+            }
+            if (i >= j) {
+                break;
+            }
+            key = keys[i];
+            keys[i++] = keys[j];
+            keys[j--] = key;
+        }
+        if (j + 1 == k) {
+            return;
+        } else if (k <= j) {
+            hi = j + 1;
+        } else {
+            lo = j + 1;
+        }
+    }
+    for (i = lo + 1; i < hi; i++) {
+        key = keys[i];
+        for (j = i; j > lo && keys[j - 1] > key; j--) {
+            keys[j] = keys[j - 1];
+        }
+        keys[j] = key;
+    }
+}
+
+// Sorts the result list, like `qsort()` with `cmp_score()` would, keeping
+// only the top `search->limit` matches (if non-zero).
+//
+// Rather than comparing matches, each one is packed into a 64-bit key (its
+// inverted score in the high half, and its rank in the low half, so the store
+// must have been ranked). When there
+// is a limit, the top keys are picked out with `select_keys()` first. The
+// keys are then radix sorted, using the pool if there's more than one
+// thread. Falls back to `qsort()` if memory runs out.
+void sort_matches(search_t *search) {
+    int err;
+    long i;
+    uint32_t bits;
+    uint64_t *keys;
+    store_t *store = search->store;
+    match_t *matches = search->sorted_matches;
+    long count = search->sorted_count;
+
+    keys = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (keys) {
+        for (i = 0; i < count; i++) {
+            // Positive floats order the same way as their bit patterns.
+            memcpy(&bits, &matches[i].score, sizeof(bits));
+            keys[i] = ((uint64_t)(UINT32_MAX - bits) << 32) |
+                store->ranks[matches[i].index];
+        }
+        if (search->limit && search->limit < count) {
+            select_keys(keys, count, search->limit);
+            count = search->limit;
+        }
+#ifdef HAVE_PTHREAD_H
+        if (search->thread_count > 1) {
+            err = radix_sort_parallel(
+                keys,
+                count,
+                search->pool,
+                search->thread_count
+            );
+        } else {
+            err = radix_sort(keys, count);
+        }
+#else
+        err = radix_sort(keys, count);
+#endif
+        if (!err) {
+            for (i = 0; i < count; i++) {
+                match_init(&matches[i], store, store->ranked[(uint32_t)keys[i]]);
+            }
+            search->sorted_count = count;
+            free(keys);
+            return;
+        }
+        free(keys);
+    }
+    qsort(matches, search->sorted_count, sizeof(match_t), cmp_score);
+}
+
+// Returns the score of path `i` for a search whose needle is "" or "." (zero
+// if it doesn't match, or is a hidden dot-file).
+static inline float alphabetic_score(search_t *search, long i) {
+    thread_args_t *args = &search->thread_args[0];
+    store_t *store = search->store;
+    uint64_t needle_bitmask = args->needle->bitmask;
+
+    if (args->needle->length == 0) {
+        if (
+            (args->never_show_dot_files == Qtrue ||
+                args->always_show_dot_files != Qtrue) &&
+            (store->flags[i] & MATCH_DOT_FILE)
+        ) {
+            return 0.0;
+        }
+        return 1.0;
+    }
+    if ((needle_bitmask & store->bitmasks[i]) != needle_bitmask) {
+        return 0.0;
+    }
+    return calculate_match(
+        STORE_PATH(store, i),
+        store->lengths[i],
+        args->needle,
+        args->always_show_dot_files,
+        args->never_show_dot_files,
+        args->recurse,
+        args->iterative,
+        store->flags[i],
+        STORE_BOUNDARIES(store, i),
+        args->scratch,
+        NULL
+    );
+}
+
+// Returns 1 (setting `search->cancelled` if appropriate) if the search has
+// been interrupted or cancelled.
+static inline int alphabetic_stopped(search_t *search) {
+    thread_args_t *args = &search->thread_args[0];
+    if (search->interrupted) {
+        return 1;
+    } else if (*args->generation != args->search_generation) {
+        search->cancelled = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Picks out the first `search->limit` visible paths for `alphabetic_search()`
+// when the store hasn't been ranked, by keeping the paths which sort first
+// in a heap (with equal scores, so that it orders them by path alone).
+void alphabetic_select(search_t *search) {
+    long i;
+    float score;
+    topk_t *heap;
+    topk_entry_t entry;
+    store_t *store = search->store;
+
+    heap = topk_new(search->limit, store);
+    if (!heap) {
+        search->thread_args[0].scratch->failed = 1;
+        search->done = 1;
+        return;
+    }
+    for (i = 0; i < store->count; i++) {
+        if (i % CHUNK_MIN == 0 && alphabetic_stopped(search)) {
+            topk_free(heap);
+            return;
+        }
+        score = alphabetic_score(search, i);
+        if (score <= 0.0) {
+            continue;
+        }
+        store->scores[i] = score;
+        if (heap->count < search->limit) {
+            topk_insert(heap, 1.0, i);
+        } else {
+            entry.score = 1.0;
+            entry.index = i;
+            if (topk_below(heap, &TOPK_PEEK(heap), &entry)) {
+                topk_replace_top(heap, 1.0, i);
+            }
+        }
+    }
+
+    // The heap yields the path which sorts last first.
+    search->sorted_count = heap->count;
+    for (i = heap->count - 1; i >= 0; i--) {
+        match_init(&search->sorted_matches[i], store, topk_extract(heap).index);
+    }
+    topk_free(heap);
+    search->done = 1;
+}
+
+// Lists the first `limit` (or, if 0, all) visible paths in lexicographic
+// order, for searches whose needle is "" or ".". Once the store has been
+// ranked, these don't need to score and sort every path: an empty needle
+// merely skips dot-files (flagged in the store), and "." scores paths only
+// until enough matches have been found. Until then, searches with a limit
+// below `SELECT_LIMIT` pick out their matches with `alphabetic_select()`.
+void alphabetic_search(search_t *search) {
+    long i, j, limit;
+    float score;
+    store_t *store = search->store;
+
+    if (!store->prepared) {
+        search->err = run_threads(search, prepare_thread);
+        if (search->err != 0) {
+            return;
+        }
+        store->prepared = 1;
+    }
+    if (!store->ranked_prepared) {
+        alphabetic_select(search);
+        return;
+    }
+
+    limit = search->limit ? search->limit : store->count;
+    search->sorted_count = 0;
+    for (j = 0; j < store->count && search->sorted_count < limit; j++) {
+        if (j % CHUNK_MIN == 0 && alphabetic_stopped(search)) {
+            return;
+        }
+        i = store->ranked[j];
+        score = alphabetic_score(search, i);
+        if (score <= 0.0) {
+            continue;
+        }
+        match_init(&search->sorted_matches[search->sorted_count], store, i);
+        search->sorted_matches[search->sorted_count++].score = score;
+    }
+    search->done = 1;
+}
+
+// Scores the paths, then gathers and sorts the matches. Doesn't touch any
+// Ruby objects, so that it can run without the GVL.
+//
+// If the search stops early (because it was interrupted, or because
+// provisional results are due), calling this again carries on from where it
+// left off. Provisional results are the best matches found so far, in
+// `sorted_matches`.
+void *search_without_gvl(void *data) {
+    long i, j;
+    topk_t *heap;
+    search_t *search = (search_t *)data;
+
+    search->started = 1;
+    if (!search->store->ranked_prepared && search->sort && !search->use_heap) {
+        // Sorting every match (or the top `SELECT_LIMIT` or more of them) goes
+        // by rank, computed once per set of paths. Ranking 200k paths takes
+        // about 45ms on a single core, more than the rest of the first search
+        // over them (about 35ms, mostly building the store) with a limit of
+        // 15, so searches with smaller limits break the few ties they meet by
+        // comparing paths instead (see `store_compare()`), and don't rank.
+        search->err = run_threads(search, rank_thread);
+        if (search->err != 0) {
+            return NULL;
+        }
+        store_rank_merge(search->store, search->thread_count);
+        search->store->ranked_prepared = 1;
+    }
+    if (search->alphabetic) {
+        alphabetic_search(search);
+        return NULL;
+    }
+    search->err = run_threads(search, match_thread);
+    if (search->err != 0) {
+        return NULL;
+    }
+    if (search->interrupted) {
+        return NULL;
+    }
+    if (
+        *search->thread_args[0].generation !=
+        search->thread_args[0].search_generation
+    ) {
+        search->cancelled = 1;
+        return NULL;
+    }
+    search->sorted_count = 0;
+    if (search->pausing) {
+        for (i = 0; i < search->thread_count; i++) {
+            heap = search->thread_args[i].heap;
+            if (heap) {
+                for (j = 0; j < heap->count; j++) {
+                    match_init(
+                        &search->sorted_matches[search->sorted_count++],
+                        search->store,
+                        heap->entries[j].index
+                    );
+                }
+            }
+        }
+        qsort(
+            search->sorted_matches,
+            search->sorted_count,
+            sizeof(match_t),
+            cmp_score
+        );
+        return NULL;
+    }
+
+    if (search->use_heap) {
+        search->err = run_threads(search, sort_thread);
+        if (search->err != 0) {
+            return NULL;
+        }
+        search->sorted_count = merge_runs(
+            search->thread_args,
+            search->thread_count,
+            search->thread_args[0].limit,
+            search->merged
+        );
+        if (search->sorted_count < 0) {
+            // Fall back to sorting all of the runs together.
+            search->sorted_count = 0;
+            for (i = 0; i < search->thread_count; i++) {
+                for (j = 0; j < search->thread_args[i].run_length; j++) {
+                    search->merged[search->sorted_count++] =
+                        search->thread_args[i].run[j];
+                }
+            }
+            qsort(
+                search->merged,
+                search->sorted_count,
+                sizeof(match_t),
+                cmp_score
+            );
+        }
+        memcpy(
+            search->sorted_matches,
+            search->merged,
+            search->sorted_count * sizeof(match_t)
+        );
+    }
+    free_heaps(search->thread_args, search->thread_count);
+
+    // Pruned and hidden candidates (see `PRUNED_SCORE` and `HIDDEN_SCORE`)
+    // survive, as they may yet match.
+    search->survivors = malloc(
+        (search->candidate_count ? search->candidate_count : 1) *
+        sizeof(uint32_t)
+    );
+    search->survivor_count = 0;
+    for (j = 0; j < search->candidate_count; j++) {
+        i = search->candidates ? (long)search->candidates[j] : j;
+        if (search->store->scores[i] == 0.0) {
+            continue;
+        }
+        if (search->survivors) {
+            search->survivors[search->survivor_count++] = i;
+        }
+        if (!search->use_heap && search->store->scores[i] > 0.0) {
+            match_init(
+                &search->sorted_matches[search->sorted_count++],
+                search->store,
+                i
+            );
+        }
+    }
+
+    if (search->sort && !search->use_heap) {
+        sort_matches(search);
+    }
+
+    // Every path has now been looked at (there are no survivors until then).
+    search->store->prepared = 1;
+    search->done = 1;
+    return NULL;
+}
+
+// Asks a running `search_without_gvl()` to stop early.
+void search_unblock(void *data) {
+    ((search_t *)data)->interrupted = 1;
+}
+
+#ifdef HAVE_RUBY_THREAD_H
+// For use with rb_protect().
+VALUE check_ints(VALUE unused) {
+    rb_thread_check_ints();
+    return Qnil;
+}
+#endif
+
+// For use with rb_protect(): `args` is a block and the array to pass to it.
+VALUE call_block(VALUE args) {
+    return rb_funcall(
+        rb_ary_entry(args, 0),
+        rb_intern("call"),
+        1,
+        rb_ary_entry(args, 1)
+    );
+}
+
+VALUE sorted_matches_for(
+    int argc,
+    VALUE *argv,
+    VALUE self,
+    unsigned long generation,
+    VALUE block
+) {
+    long i, limit, path_count, candidate_count, thread_count, chunk_size;
+    long progress_paths;
+    double progress_seconds;
+    int alphabetic;
+    int compute_bitmasks;
+    int iterative;
+    int state;
+    int use_heap;
+    int sort;
+    match_t *sorted_matches;
+    needle_t compiled_needle;
+    scratch_t **scratches;
+    search_t *search;
+    store_t *store;
+    survivor_stack_t *stack;
+    survivors_t *survivors;
     thread_args_t *thread_args;
     VALUE always_show_dot_files;
+    VALUE cache;
+    VALUE cache_key;
+    VALUE cached;
     VALUE case_sensitive;
+    VALUE engine_option;
     VALUE recurse;
     VALUE ignore_spaces;
     VALUE limit_option;
-    VALUE last_needle;
     VALUE needle;
     VALUE never_show_dot_files;
     VALUE new_paths_object_id;
     VALUE options;
+    VALUE path;
     VALUE paths;
+    VALUE positions;
+    VALUE positions_option;
+    VALUE progress_paths_option;
+    VALUE progress_seconds_option;
+    VALUE provisional;
+    VALUE stats;
+    VALUE thread_stats_option;
     VALUE paths_object_id;
     VALUE results;
     VALUE scanner;
     VALUE sort_option;
     VALUE threads_option;
-    VALUE wrapped_matches;
+    VALUE wrapped_search;
+    VALUE wrapped_store;
 
     // Process arguments: 1 mandatory, 1 optional.
     if (rb_scan_args(argc, argv, "11", &needle, &options) == 1) {
@@ -208,6 +1197,12 @@ VALUE CommandTMatcher_sorted_matches_for(int argc, VALUE *argv, VALUE self)
     if (NIL_P(needle)) {
         rb_raise(rb_eArgError, "nil needle");
     }
+    if (*generation_for(self) != generation) {
+        // Cancelled while waiting for an earlier search to finish.
+        rb_iv_set(self, "@positions", Qnil);
+        rb_iv_set(self, "@thread_stats", Qnil);
+        return Qnil;
+    }
 
     // Check optional options hash for overrides.
     case_sensitive = CommandT_option_from_hash("case_sensitive", options);
@@ -218,191 +1213,457 @@ VALUE CommandTMatcher_sorted_matches_for(int argc, VALUE *argv, VALUE self)
     always_show_dot_files = rb_iv_get(self, "@always_show_dot_files");
     never_show_dot_files = rb_iv_get(self, "@never_show_dot_files");
     recurse = CommandT_option_from_hash("recurse", options);
+    engine_option = CommandT_option_from_hash("engine", options);
+    positions_option = CommandT_option_from_hash("positions", options);
+    thread_stats_option = CommandT_option_from_hash("thread_stats", options);
+    progress_paths_option = CommandT_option_from_hash("progress_paths", options);
+    progress_seconds_option =
+        CommandT_option_from_hash("progress_seconds", options);
 
     limit = NIL_P(limit_option) ? 15 : NUM2LONG(limit_option);
     sort = NIL_P(sort_option) || sort_option == Qtrue;
-    use_heap = limit && sort;
-    heap_matches_count = 0;
+    use_heap = limit && sort && limit < SELECT_LIMIT;
 
-    needle = StringValue(needle);
-    if (case_sensitive != Qtrue) {
-        needle = rb_funcall(needle, rb_intern("downcase"), 0);
+    // Provisional results come from the per-thread heaps, so are only
+    // available for sorted searches with a limit below `SELECT_LIMIT`.
+    progress_paths = 0;
+    progress_seconds = 0.0;
+    if (use_heap && !NIL_P(block)) {
+        if (!NIL_P(progress_paths_option)) {
+            progress_paths = NUM2LONG(progress_paths_option);
+        }
+        if (!NIL_P(progress_seconds_option)) {
+            progress_seconds = NUM2DBL(progress_seconds_option);
+        }
     }
 
-    if (ignore_spaces == Qtrue) {
-        needle = rb_funcall(needle, rb_intern("delete"), 1, rb_str_new2(" "));
+    // Scoring engine: both produce identical scores; "recursive" is the
+    // original implementation, retained for comparison purposes.
+    if (
+        NIL_P(engine_option) ||
+        rb_to_id(engine_option) == rb_intern("iterative")
+    ) {
+        iterative = 1;
+    } else if (rb_to_id(engine_option) == rb_intern("recursive")) {
+        iterative = 0;
+    } else {
+        rb_raise(rb_eArgError, "unknown engine");
     }
 
+    needle_compile(
+        &compiled_needle,
+        needle,
+        case_sensitive == Qtrue,
+        ignore_spaces == Qtrue
+    );
+
     // Get unsorted matches.
     scanner = rb_iv_get(self, "@scanner");
     paths = rb_funcall(scanner, rb_intern("paths"), 0);
-    path_count = RARRAY_LEN(paths);
 
     // Cached C data, not visible to Ruby layer.
     paths_object_id = rb_ivar_get(self, rb_intern("paths_object_id"));
     new_paths_object_id = rb_funcall(paths, rb_intern("object_id"), 0);
-    rb_ivar_set(self, rb_intern("paths_object_id"), new_paths_object_id);
-    last_needle = rb_ivar_get(self, rb_intern("last_needle"));
+    stack = survivor_stack_for(self);
     if (
         NIL_P(paths_object_id) ||
         rb_equal(new_paths_object_id, paths_object_id) != Qtrue
     ) {
-        // `paths` changed, need to replace matches array.
-        paths_object_id = new_paths_object_id;
-        matches = malloc(path_count * sizeof(match_t));
-        if (!matches) {
+        // `paths` changed, need to replace the store.
+        store = store_new(paths);
+        if (!store) {
             rb_raise(rb_eNoMemError, "memory allocation failed");
         }
-        wrapped_matches = Data_Wrap_Struct(
-            rb_cObject,
-            0,
-            free,
-            matches
-        );
-        rb_ivar_set(self, rb_intern("matches"), wrapped_matches);
-        last_needle = Qnil;
+        wrapped_store = Data_Wrap_Struct(rb_cObject, 0, store_free, store);
+        rb_ivar_set(self, rb_intern("store"), wrapped_store);
+
+        survivor_stack_clear(stack);
+        rb_ivar_set(self, rb_intern("cache"), Qnil);
+
+        // Record the new paths only once their store and cache are in place,
+        // so that if building the store fails the next search tries again
+        // instead of reusing the old one.
+        rb_ivar_set(self, rb_intern("paths_object_id"), new_paths_object_id);
     } else {
-        // Get existing array.
-        Data_Get_Struct(
-            rb_ivar_get(self, rb_intern("matches")),
-            match_t,
-            matches
-        );
+        // Get existing store.
+        Data_Get_Struct(rb_ivar_get(self, rb_intern("store")), store_t, store);
+    }
 
-        // Will compare against previously computed haystack bitmasks.
-        needle_bitmask = calculate_bitmask(needle);
+    // Answer repeated searches (eg. because the user deleted characters and
+    // then typed them again) from the cache, without scoring anything.
+    if (NUM2LONG(rb_iv_get(self, "@cache_size")) > 0) {
+        cache = cache_for(self);
+        cache_key = cache_key_for(
+            &compiled_needle,
+            (case_sensitive == Qtrue) |
+            (recurse == Qtrue) << 1 |
+            (ignore_spaces == Qtrue) << 2 |
+            sort << 3 |
+            (positions_option == Qtrue) << 4,
+            limit
+        );
+        cached = rb_hash_lookup(cache, cache_key);
+        if (!NIL_P(cached)) {
+            // Move to the most recently used end.
+            rb_hash_delete(cache, cache_key);
+            rb_hash_aset(cache, cache_key, cached);
+            cache_count(self, "@cache_hits");
 
-        // Check whether current search extends previous search; if so, we can
-        // skip all the non-matches from last time without looking at them.
-        if (rb_funcall(needle, rb_intern("start_with?"), 1, last_needle) != Qtrue) {
-            last_needle = Qnil;
+            // Copies, so that callers can't modify what's in the cache.
+            positions = rb_ary_entry(cached, 1);
+            rb_iv_set(
+                self,
+                "@positions",
+                NIL_P(positions) ? Qnil : rb_obj_dup(positions)
+            );
+            rb_iv_set(
+                self,
+                "@thread_stats",
+                thread_stats_option == Qtrue ? rb_ary_new() : Qnil
+            );
+            return rb_ary_dup(rb_ary_entry(cached, 0));
         }
+        cache_count(self, "@cache_misses");
+    } else {
+        cache = Qnil;
+        cache_key = Qnil;
     }
 
+    // If an earlier search was for a prefix of this one (eg. because the user
+    // typed or deleted a character), only its survivors can match.
+    survivors = survivor_stack_find(
+        stack,
+        (case_sensitive == Qtrue) | (recurse == Qtrue) << 1,
+        compiled_needle.bytes,
+        compiled_needle.length
+    );
+
+    path_count = store->count;
+    candidate_count = survivors ? survivors->count : path_count;
     thread_count = NIL_P(threads_option) ? 1 : NUM2LONG(threads_option);
-    if (use_heap) {
-        heap_matches = malloc(thread_count * limit * sizeof(match_t));
-        if (!heap_matches) {
-            rb_raise(rb_eNoMemError, "memory allocation failed");
-        }
-    }
+
+    // The search's buffers hang off a Ruby object, so that they are freed
+    // (when it is collected) even if something below raises.
+    wrapped_search =
+        Data_Make_Struct(rb_cObject, search_t, 0, search_free, search);
 
 #ifdef HAVE_PTHREAD_H
 #define THREAD_THRESHOLD 1000 /* avoid the overhead of threading when search space is small */
     if (path_count < THREAD_THRESHOLD) {
         thread_count = 1;
     }
-    threads = malloc(sizeof(pthread_t) * thread_count);
-    if (!threads)
-        rb_raise(rb_eNoMemError, "memory allocation failed");
+    search->pool = thread_count > 1 ? pool_for(self) : NULL;
+#else
+    thread_count = 1;
 #endif
 
-    thread_args = malloc(sizeof(thread_args_t) * thread_count);
-    if (!thread_args)
+    // Chunks should be small enough to balance the load when some paths are
+    // much more expensive to score than others, but big enough that claiming
+    // them is cheap.
+    chunk_size = candidate_count / (thread_count * 16) / CHUNK_MIN * CHUNK_MIN;
+    if (chunk_size < CHUNK_MIN) {
+        chunk_size = CHUNK_MIN;
+    } else if (chunk_size > CHUNK_MAX) {
+        chunk_size = CHUNK_MAX;
+    }
+
+    scratches = scratches_for(self, thread_count);
+    if (use_heap) {
+        search->sorted_matches = malloc(thread_count * limit * sizeof(match_t));
+        search->merged = malloc(limit * sizeof(match_t));
+    } else {
+        search->sorted_matches = malloc(path_count * sizeof(match_t));
+    }
+    search->thread_args = malloc(sizeof(thread_args_t) * thread_count);
+    search->returns = malloc(sizeof(void *) * thread_count);
+    if (
+        !search->sorted_matches ||
+        (use_heap && !search->merged) ||
+        !search->thread_args ||
+        !search->returns
+    ) {
         rb_raise(rb_eNoMemError, "memory allocation failed");
+    }
+    sorted_matches = search->sorted_matches;
+    thread_args = search->thread_args;
+
+    // Alphabetic order if search string is only "" or "."
+    alphabetic = sort && (
+        compiled_needle.length == 0 ||
+        (compiled_needle.length == 1 && compiled_needle.bytes[0] == '.')
+    );
+    compute_bitmasks = !store->prepared;
+
     for (i = 0; i < thread_count; i++) {
         thread_args[i].thread_count = thread_count;
         thread_args[i].thread_index = i;
-        thread_args[i].case_sensitive = case_sensitive == Qtrue;
-        thread_args[i].matches = matches;
+        thread_args[i].cursor = &search->cursor;
+        thread_args[i].chunk_size = chunk_size;
         thread_args[i].limit = use_heap ? limit : 0;
-        thread_args[i].path_count = path_count;
-        thread_args[i].haystacks = paths;
-        thread_args[i].needle = needle;
-        thread_args[i].last_needle = last_needle;
+        thread_args[i].store = store;
+        thread_args[i].needle = &compiled_needle;
+        thread_args[i].candidates = survivors ? survivors->indices : NULL;
+        thread_args[i].candidate_count = candidate_count;
         thread_args[i].always_show_dot_files = always_show_dot_files;
         thread_args[i].never_show_dot_files = never_show_dot_files;
         thread_args[i].recurse = recurse;
-        thread_args[i].needle_bitmask = needle_bitmask;
+        thread_args[i].iterative = iterative;
+        thread_args[i].compute_bitmasks = compute_bitmasks;
+        thread_args[i].scratch = scratches[i];
+        thread_args[i].interrupted = &search->interrupted;
+        thread_args[i].generation = generation_for(self);
+        thread_args[i].search_generation = generation;
+        thread_args[i].pausing = &search->pausing;
+        thread_args[i].heap = NULL;
+        thread_args[i].run = use_heap ? &sorted_matches[i * limit] : NULL;
+        thread_args[i].run_length = 0;
+        thread_args[i].chunks = 0;
+        thread_args[i].paths = 0;
+        thread_args[i].busy = 0.0;
+    }
 
-#ifdef HAVE_PTHREAD_H
-        if (i == thread_count - 1) {
+    search->thread_count = thread_count;
+    search->store = store;
+    search->candidates = thread_args[0].candidates;
+    search->candidate_count = thread_args[0].candidate_count;
+    search->survivors = NULL;
+    search->limit = limit;
+    search->use_heap = use_heap;
+    search->sort = sort;
+    search->alphabetic = alphabetic;
+    search->err = 0;
+    search->done = 0;
+    search->cancelled = 0;
+    search->cursor = 0;
+
+    for (;;) {
+        search->started = 0;
+        search->interrupted = 0;
+        search->pausing = 0;
+        for (i = 0; i < thread_count; i++) {
+            thread_args[i].pause_paths = progress_paths > 0 ?
+                thread_args[i].paths + (progress_paths + thread_count - 1) /
+                    thread_count :
+                0;
+            thread_args[i].pause_time = progress_seconds > 0.0 ?
+                now() + progress_seconds :
+                0.0;
+        }
+#ifdef HAVE_RUBY_THREAD_H
+        rb_thread_call_without_gvl2(
+            search_without_gvl,
+            search,
+            search_unblock,
+            search
+        );
+#else
+        search_without_gvl(search);
 #endif
-            // For the last "worker", we'll just use the main thread.
-            heap = match_thread(&thread_args[i]);
-            if (heap) {
-                for (j = 0; j < heap->count; j++) {
-                    heap_matches[heap_matches_count++] = *(match_t *)heap->entries[j];
-                }
-                heap_free(heap);
+        if (search->done || search->err || search->cancelled) {
+            break;
+        }
+
+        if (search->pausing && !search->interrupted) {
+            // Report provisional results, then carry on.
+            provisional = rb_ary_new();
+            for (i = 0; i < search->sorted_count && i < limit; i++) {
+                rb_ary_push(
+                    provisional,
+                    rb_ary_entry(paths, search->sorted_matches[i].index)
+                );
             }
-#ifdef HAVE_PTHREAD_H
+            rb_protect(call_block, rb_assoc_new(block, provisional), &state);
         } else {
-            err = pthread_create(&threads[i], NULL, match_thread, (void *)&thread_args[i]);
-            if (err != 0) {
-                rb_raise(rb_eSystemCallError, "pthread_create() failure (%d)", (int)err);
-            }
-        }
+            // Interrupted (possibly before starting): let Ruby handle it, and
+            // then, unless that raised, carry on.
+#ifdef HAVE_RUBY_THREAD_H
+            rb_protect(check_ints, Qnil, &state);
+#else
+            state = 0;
 #endif
+        }
+        if (state) {
+            search_release(search);
+            rb_jump_tag(state);
+        }
     }
+    free_heaps(thread_args, thread_count);
 
-#ifdef HAVE_PTHREAD_H
-    for (i = 0; i < thread_count - 1; i++) {
-        err = pthread_join(threads[i], (void **)&heap);
-        if (err != 0) {
-            rb_raise(rb_eSystemCallError, "pthread_join() failure (%d)", (int)err);
-        }
-        if (heap) {
-            for (j = 0; j < heap->count; j++) {
-                heap_matches[heap_matches_count++] = *(match_t *)heap->entries[j];
-            }
-            heap_free(heap);
-        }
+    if (search->cancelled) {
+        search_release(search);
+        rb_iv_set(self, "@positions", Qnil);
+        rb_iv_set(self, "@thread_stats", Qnil);
+        return Qnil;
     }
-    free(threads);
-#endif
 
-    if (sort) {
-        if (
-            RSTRING_LEN(needle) == 0 ||
-            (RSTRING_LEN(needle) == 1 && RSTRING_PTR(needle)[0] == '.')
-        ) {
-            // Alphabetic order if search string is only "" or "."
-            // TODO: make those semantics fully apply to heap case as well
-            // (they don't because the heap itself calls cmp_score, which means
-            // that the items which stay in the top [limit] may (will) be
-            // different).
-            qsort(
-                use_heap ? heap_matches : matches,
-                use_heap ? heap_matches_count : path_count,
-                sizeof(match_t),
-                cmp_alpha
-            );
-        } else {
-            qsort(
-                use_heap ? heap_matches : matches,
-                use_heap ? heap_matches_count : path_count,
-                sizeof(match_t),
-                cmp_score
-            );
+    if (search->err != 0) {
+        search_release(search);
+        rb_raise(
+            rb_eSystemCallError,
+            "pthread_create() failure (%d)",
+            search->err
+        );
+    }
+
+    for (i = 0; i < thread_count; i++) {
+        if (scratches[i]->failed) {
+            search_release(search);
+            rb_ivar_set(self, rb_intern("paths_object_id"), Qnil);
+            rb_raise(rb_eNoMemError, "memory allocation failed");
         }
     }
 
     results = rb_ary_new();
+    positions = positions_option == Qtrue ? rb_hash_new() : Qnil;
     if (limit == 0) {
         limit = path_count;
     }
-    for (
-        i = 0;
-        i < (use_heap ? heap_matches_count : path_count) && limit > 0;
-        i++
-    ) {
-        if ((use_heap ? heap_matches : matches)[i].score > 0.0) {
-            rb_funcall(
-                results,
-                rb_intern("push"),
-                1,
-                (use_heap ? heap_matches : matches)[i].path
-            );
+    for (i = 0; i < search->sorted_count && limit > 0; i++) {
+        if (search->sorted_matches[i].score > 0.0) {
+            path = rb_ary_entry(paths, search->sorted_matches[i].index);
+            rb_funcall(results, rb_intern("push"), 1, path);
+            if (!NIL_P(positions)) {
+                rb_hash_aset(
+                    positions,
+                    path,
+                    positions_for(&search->sorted_matches[i], &thread_args[0])
+                );
+            }
             limit--;
         }
     }
 
-    if (use_heap) {
-        free(heap_matches);
+    if (thread_stats_option == Qtrue) {
+        stats = rb_ary_new2(thread_count);
+        for (i = 0; i < thread_count; i++) {
+            VALUE thread_stats = rb_hash_new();
+            rb_hash_aset(
+                thread_stats,
+                ID2SYM(rb_intern("chunks")),
+                LONG2NUM(thread_args[i].chunks)
+            );
+            rb_hash_aset(
+                thread_stats,
+                ID2SYM(rb_intern("paths")),
+                LONG2NUM(thread_args[i].paths)
+            );
+            rb_hash_aset(
+                thread_stats,
+                ID2SYM(rb_intern("busy")),
+                rb_float_new(thread_args[i].busy)
+            );
+            rb_ary_push(stats, thread_stats);
+        }
+    } else {
+        stats = Qnil;
     }
 
     // Save this state to potentially speed subsequent searches.
-    rb_ivar_set(self, rb_intern("last_needle"), needle);
+    if (
+        search->survivors &&
+        (!survivors || survivors->needle_length < compiled_needle.length)
+    ) {
+        // Hand the survivors over to the stack (which frees them on failure).
+        survivor_stack_push(
+            stack,
+            compiled_needle.bytes,
+            compiled_needle.length,
+            search->survivors,
+            search->survivor_count
+        );
+        search->survivors = NULL;
+    }
+    search_release(search);
+    if (!NIL_P(cache)) {
+        rb_hash_aset(
+            cache,
+            cache_key,
+            rb_assoc_new(
+                rb_ary_dup(results),
+                NIL_P(positions) ? Qnil : rb_obj_dup(positions)
+            )
+        );
+        if (
+            NUM2LONG(rb_funcall(cache, rb_intern("size"), 0)) >
+            NUM2LONG(rb_iv_get(self, "@cache_size"))
+        ) {
+            // Evict the least recently used entry.
+            rb_funcall(cache, rb_intern("shift"), 0);
+        }
+    }
+    rb_iv_set(self, "@positions", positions);
+    rb_iv_set(self, "@thread_stats", stats);
+    RB_GC_GUARD(compiled_needle.storage);
+    RB_GC_GUARD(paths);
+    RB_GC_GUARD(wrapped_search);
     return results;
 }
+
+#ifdef HAVE_RUBY_THREAD_H
+typedef struct {
+    int argc;
+    VALUE *argv;
+    VALUE self;
+    unsigned long generation;
+    VALUE block;
+} sorted_matches_for_args_t;
+
+// For use with rb_mutex_synchronize().
+VALUE sorted_matches_for_locked(VALUE data) {
+    sorted_matches_for_args_t *args = (sorted_matches_for_args_t *)data;
+    return sorted_matches_for(
+        args->argc,
+        args->argv,
+        args->self,
+        args->generation,
+        args->block
+    );
+}
+#endif
+
+VALUE CommandTMatcher_sorted_matches_for(int argc, VALUE *argv, VALUE self)
+{
+    volatile unsigned long *generation = generation_for(self);
+    VALUE block = rb_block_given_p() ? rb_block_proc() : Qnil;
+    VALUE supersede = CommandT_option_from_hash(
+        "supersede",
+        argc > 1 ? argv[1] : Qnil
+    );
+
+    // Cancel any searches that are already running or waiting to run, so
+    // that this one doesn't have to wait for them.
+    if (supersede == Qtrue) {
+        (*generation)++;
+    }
+
+#ifdef HAVE_RUBY_THREAD_H
+    // Matching runs without the GVL, so searches on the same matcher from
+    // different threads must be serialized explicitly, as they share cached
+    // state.
+    sorted_matches_for_args_t args;
+    VALUE mutex = rb_ivar_get(self, rb_intern("mutex"));
+
+    if (NIL_P(mutex)) {
+        mutex = rb_mutex_new();
+        rb_ivar_set(self, rb_intern("mutex"), mutex);
+    }
+    args.argc = argc;
+    args.argv = argv;
+    args.self = self;
+    args.generation = *generation;
+    args.block = block;
+    return rb_mutex_synchronize(
+        mutex,
+        sorted_matches_for_locked,
+        (VALUE)&args
+    );
+#else
+    return sorted_matches_for(argc, argv, self, *generation, block);
+#endif
+}
+
+VALUE CommandTMatcher_cancel(VALUE self)
+{
+    (*generation_for(self))++;
+    return Qnil;
+}
@@ -5,3 +5,4 @@
 
 extern VALUE CommandTMatcher_initialize(int argc, VALUE *argv, VALUE self);
 extern VALUE CommandTMatcher_sorted_matches_for(int argc, VALUE *argv, VALUE self);
+extern VALUE CommandTMatcher_cancel(VALUE self);
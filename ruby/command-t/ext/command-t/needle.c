@@ -0,0 +1,80 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+#include <stdlib.h> /* for free(), malloc() */
+
+#include "match.h"
+#include "utf8.h"
+#include "ruby_compat.h"
+
+/**
+ * Compiles `string` into `needle`; the caller must keep `needle->storage`
+ * alive for as long as `needle` is in use.
+ *
+ * The compiled needle lives in native memory, so that it can be used without
+ * the GVL.
+ *
+ * `string` is treated as UTF-8, and (unless `case_sensitive`) folded using
+ * Unicode simple case folding.
+ */
+void needle_compile(
+    needle_t *needle,
+    VALUE string,
+    int case_sensitive,
+    int ignore_spaces
+) {
+    long i, length, codepoint_length;
+    const char *source;
+    long source_length;
+    char *bytes;
+    uint32_t *codepoints;
+
+    string = StringValue(string);
+    source = RSTRING_PTR(string);
+    source_length = RSTRING_LEN(string);
+
+    // Folding may grow a character (eg. from 2 to 3 bytes), but never
+    // beyond 4 bytes.
+    needle->storage = Data_Wrap_Struct(rb_cObject, 0, free, NULL);
+    codepoints = malloc(source_length * (sizeof(uint32_t) + 4) + 1);
+    if (!codepoints) {
+        rb_raise(rb_eNoMemError, "memory allocation failed");
+    }
+    DATA_PTR(needle->storage) = codepoints;
+    bytes = (char *)(codepoints + source_length);
+
+    for (i = 0; i < 256; i++) {
+        needle->fold[i] = !case_sensitive && i >= 'A' && i <= 'Z' ?
+            i + ('a' - 'A') :
+            i;
+    }
+
+    length = 0;
+    codepoint_length = 0;
+    needle->ascii = 1;
+    needle->bitmask = 0;
+    for (i = 0; i < source_length; ) {
+        uint32_t codepoint;
+        i += utf8_decode(source + i, source_length - i, &codepoint);
+        if (codepoint == ' ' && ignore_spaces) {
+            continue;
+        }
+        if (!case_sensitive) {
+            codepoint = utf8_fold(codepoint);
+        }
+        if (codepoint < 0x80) {
+            needle->bitmask |= bitmask_for_char(codepoint);
+        } else {
+            needle->ascii = 0;
+        }
+        codepoints[codepoint_length++] = codepoint;
+        length += utf8_encode(codepoint, bytes + length);
+    }
+
+    needle->bytes = bytes;
+    needle->length = length;
+    needle->codepoints = codepoints;
+    needle->codepoint_length = codepoint_length;
+    needle->case_sensitive = case_sensitive;
+    needle->inverse_length = 1.0 / codepoint_length;
+}
@@ -0,0 +1,30 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * A search string, compiled once per query into the form the scorer wants, so
+ * that matcher threads can share it without touching any Ruby objects.
+ */
+
+#include <ruby.h>
+#include <stdint.h> /* for uint32_t, uint64_t */
+
+typedef struct {
+    const char *bytes;           // Folded (unless case-sensitive) UTF-8 bytes.
+    long length;                 // Length of same.
+    const uint32_t *codepoints;  // Same, decoded.
+    long codepoint_length;       // Length of same.
+    int ascii;                   // Boolean: all codepoints are ASCII.
+    int case_sensitive;          // Boolean.
+    uint64_t bitmask;            // Character classes present (see match.h).
+    double inverse_length;       // `1.0 / codepoint_length`.
+    unsigned char fold[256];     // Maps haystack bytes to needle-comparable bytes.
+    VALUE storage;               // Owns `bytes` and `codepoints`.
+} needle_t;
+
+void needle_compile(
+    needle_t *needle,
+    VALUE string,
+    int case_sensitive,
+    int ignore_spaces
+);
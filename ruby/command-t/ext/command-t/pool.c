@@ -0,0 +1,220 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+#include <errno.h>  /* for ENOMEM */
+#include <stdlib.h> /* for free(), malloc(), realloc(), NULL */
+#include <unistd.h> /* for getpid() */
+
+// order matters; we want HAVE_PTHREAD_H to be evaluated only after ruby.h
+#include <ruby.h>
+#include "pool.h"
+
+#ifdef HAVE_PTHREAD_H
+
+struct pool_worker {
+    pool_t *pool;
+    pthread_t thread;
+    long index;
+    unsigned long batch; // Last batch seen by this worker.
+};
+
+static void *pool_worker_main(void *arg) {
+    void *result;
+    pool_worker_t *worker = (pool_worker_t *)arg;
+    pool_t *pool = worker->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->shutdown && worker->batch == pool->batch) {
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        worker->batch = pool->batch;
+        if (worker->index >= pool->active) {
+            // Not needed for this batch.
+            continue;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        result = pool->job(pool->args + worker->index * pool->arg_size);
+        pthread_mutex_lock(&pool->mutex);
+        pool->results[worker->index] = result;
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+static int pool_init(pool_t *pool) {
+    int err;
+
+    pool->workers = NULL;
+    pool->size = 0;
+    pool->batch = 0;
+    pool->active = 0;
+    pool->pending = 0;
+    pool->shutdown = 0;
+    pool->pid = getpid();
+
+    err = pthread_mutex_init(&pool->mutex, NULL);
+    if (err) {
+        return err;
+    }
+    err = pthread_cond_init(&pool->work, NULL);
+    if (err) {
+        pthread_mutex_destroy(&pool->mutex);
+        return err;
+    }
+    err = pthread_cond_init(&pool->done, NULL);
+    if (err) {
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->mutex);
+        return err;
+    }
+    return 0;
+}
+
+// Frees the bookkeeping for all workers (which must no longer be running).
+static void pool_forget_workers(pool_t *pool) {
+    long i;
+    for (i = 0; i < pool->size; i++) {
+        free(pool->workers[i]);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->size = 0;
+}
+
+// Starts workers until there are at least `size` of them.
+static int pool_grow(pool_t *pool, long size) {
+    int err;
+    pool_worker_t *worker;
+    pool_worker_t **workers;
+
+    if (size <= pool->size) {
+        return 0;
+    }
+    workers = realloc(pool->workers, size * sizeof(pool_worker_t *));
+    if (!workers) {
+        return ENOMEM;
+    }
+    pool->workers = workers;
+    while (pool->size < size) {
+        worker = malloc(sizeof(pool_worker_t));
+        if (!worker) {
+            return ENOMEM;
+        }
+        worker->pool = pool;
+        worker->index = pool->size;
+        worker->batch = pool->batch;
+        err = pthread_create(&worker->thread, NULL, pool_worker_main, worker);
+        if (err) {
+            free(worker);
+            return err;
+        }
+        pool->workers[pool->size++] = worker;
+    }
+    return 0;
+}
+
+/**
+ * Returns a new pool with no workers, or NULL on failure.
+ */
+pool_t *pool_new(void) {
+    pool_t *pool = malloc(sizeof(pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    if (pool_init(pool)) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/**
+ * Stops and joins all workers, then frees the pool.
+ */
+void pool_free(pool_t *pool) {
+    long i;
+
+    if (pool->pid == getpid()) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->shutdown = 1;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->mutex);
+        for (i = 0; i < pool->size; i++) {
+            pthread_join(pool->workers[i]->thread, NULL);
+        }
+        pthread_cond_destroy(&pool->done);
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->mutex);
+    }
+    // Otherwise, we're in a forked child: the workers don't exist here, and
+    // the synchronization primitives can't be trusted.
+    pool_forget_workers(pool);
+    free(pool);
+}
+
+/**
+ * Calls `job` once for each of the `count` consecutive `arg_size`-byte
+ * arguments in `args`, storing the return values in `results`, and returns
+ * once all calls have finished.
+ *
+ * The calling thread handles the last argument itself; the rest are handed
+ * to workers, which are started if the pool doesn't already have enough.
+ *
+ * Returns 0 on success, or an error number if workers could not be started
+ * (in which case `job` has not been called at all).
+ */
+int pool_run(
+    pool_t *pool,
+    long count,
+    pool_job_t job,
+    void *args,
+    size_t arg_size,
+    void **results
+) {
+    int err;
+
+    if (pool->pid != getpid()) {
+        // Forked since the workers were started; start again from scratch.
+        pool_forget_workers(pool);
+        err = pool_init(pool);
+        if (err) {
+            return err;
+        }
+    }
+    if (count < 1) {
+        return 0;
+    }
+    err = pool_grow(pool, count - 1);
+    if (err) {
+        return err;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = job;
+    pool->args = args;
+    pool->arg_size = arg_size;
+    pool->results = results;
+    pool->active = count - 1;
+    pool->pending = count - 1;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+
+    results[count - 1] = job((char *)args + (count - 1) * arg_size);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,48 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * A persistent pool of worker threads.
+ *
+ * Workers are started on demand and then park on a condition variable
+ * between batches, so that thread creation is paid once rather than on every
+ * search.
+ */
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>   /* for pthread_cond_t, pthread_mutex_t, pthread_t */
+#include <stddef.h>    /* for size_t */
+#include <sys/types.h> /* for pid_t */
+
+typedef void *(*pool_job_t)(void *arg);
+
+typedef struct pool_worker pool_worker_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;  // Signalled when a batch is posted (or on shutdown).
+    pthread_cond_t done;  // Signalled when the last worker finishes a batch.
+    pool_worker_t **workers;
+    long size;
+    unsigned long batch;  // Incremented for each posted batch.
+    long active;          // Number of workers taking part in current batch.
+    long pending;         // Number of those which haven't finished yet.
+    pool_job_t job;
+    char *args;
+    size_t arg_size;
+    void **results;
+    int shutdown;
+    pid_t pid;            // Process which started the workers.
+} pool_t;
+
+pool_t *pool_new(void);
+void pool_free(pool_t *pool);
+int pool_run(
+    pool_t *pool,
+    long count,
+    pool_job_t job,
+    void *args,
+    size_t arg_size,
+    void **results
+);
+#endif
@@ -0,0 +1,237 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+#include "prescan.h"
+
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define PRESCAN_SIMD
+#include <immintrin.h> /* for SSE2 and AVX2 intrinsics */
+#endif
+
+prescan_t prescan = prescan_scalar;
+
+/**
+ * @internal
+ *
+ * Scans haystack positions `[0, end)` from right to left, continuing from
+ * needle character `needle_idx` (and working towards the start of the
+ * needle).
+ *
+ * Returns the index of the next needle character still to be found, or -1 if
+ * they have all been found.
+ */
+static long prescan_tail(
+    const char *haystack_p,
+    long end,
+    const char *needle_p,
+    long needle_idx,
+    int case_sensitive,
+    long *rightmost_match_p
+) {
+    long i;
+    for (i = end - 1; i >= 0 && needle_idx >= 0; i--) {
+        char c = haystack_p[i];
+        if (!case_sensitive && c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c == needle_p[needle_idx]) {
+            rightmost_match_p[needle_idx] = i;
+            needle_idx--;
+        }
+    }
+    return needle_idx;
+}
+
+/**
+ * Portable implementation, one byte at a time. Only used when neither vector
+ * kernel is available (other architectures or compilers, or CPUs without
+ * SSE2); otherwise every search uses the kernel picked by `prescan_init()`.
+ */
+int prescan_scalar(
+    const char *haystack_p,
+    long haystack_len,
+    const char *needle_p,
+    long needle_len,
+    int case_sensitive,
+    long *rightmost_match_p
+) {
+    return prescan_tail(
+        haystack_p,
+        haystack_len,
+        needle_p,
+        needle_len - 1,
+        case_sensitive,
+        rightmost_match_p
+    ) == -1;
+}
+
+#ifdef PRESCAN_SIMD
+
+/**
+ * @internal
+ *
+ * Scans haystack positions before `*block` from right to left, 16 bytes at a
+ * time, lowercasing as we go, until there are fewer than 16 bytes left. This
+ * is always inlined so that it gets VEX-encoded when used from the AVX2
+ * implementation (mixing legacy SSE and AVX code incurs a transition penalty).
+ *
+ * Updates `*block` and returns the index of the next needle character still
+ * to be found (see `prescan_tail()`).
+ */
+__attribute__((always_inline, target("sse2")))
+static inline long prescan_sse2_blocks(
+    const char *haystack_p,
+    long *block,
+    const char *needle_p,
+    long needle_idx,
+    int case_sensitive,
+    long *rightmost_match_p
+) {
+    const __m128i upper_min = _mm_set1_epi8('A' - 1);
+    const __m128i upper_max = _mm_set1_epi8('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8('a' - 'A');
+
+    while (*block >= 16 && needle_idx >= 0) {
+        unsigned int candidates = 0xffff; // Bits still eligible in this block.
+        __m128i bytes;
+
+        *block -= 16;
+        bytes = _mm_loadu_si128((const __m128i *)(haystack_p + *block));
+        if (!case_sensitive) {
+            __m128i is_upper = _mm_and_si128(
+                _mm_cmpgt_epi8(bytes, upper_min),
+                _mm_cmplt_epi8(bytes, upper_max)
+            );
+            bytes = _mm_or_si128(bytes, _mm_and_si128(is_upper, case_bit));
+        }
+
+        // Find as many needle characters as possible within this block.
+        while (needle_idx >= 0) {
+            unsigned int found = candidates & (unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(bytes, _mm_set1_epi8(needle_p[needle_idx]))
+            );
+            int bit;
+            if (!found) {
+                break;
+            }
+            bit = 31 - __builtin_clz(found);
+            rightmost_match_p[needle_idx--] = *block + bit;
+            candidates = (1u << bit) - 1;
+        }
+    }
+    return needle_idx;
+}
+
+/**
+ * SSE2 implementation: lowercases and compares 16 bytes at a time.
+ */
+__attribute__((target("sse2")))
+static int prescan_sse2(
+    const char *haystack_p,
+    long haystack_len,
+    const char *needle_p,
+    long needle_len,
+    int case_sensitive,
+    long *rightmost_match_p
+) {
+    long block = haystack_len;
+    long needle_idx = prescan_sse2_blocks(
+        haystack_p,
+        &block,
+        needle_p,
+        needle_len - 1,
+        case_sensitive,
+        rightmost_match_p
+    );
+    return prescan_tail(
+        haystack_p,
+        block,
+        needle_p,
+        needle_idx,
+        case_sensitive,
+        rightmost_match_p
+    ) == -1;
+}
+
+/**
+ * AVX2 implementation: lowercases and compares 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+static int prescan_avx2(
+    const char *haystack_p,
+    long haystack_len,
+    const char *needle_p,
+    long needle_len,
+    int case_sensitive,
+    long *rightmost_match_p
+) {
+    long needle_idx = needle_len - 1;
+    long block = haystack_len;
+    const __m256i upper_min = _mm256_set1_epi8('A' - 1);
+    const __m256i upper_max = _mm256_set1_epi8('Z' + 1);
+    const __m256i case_bit = _mm256_set1_epi8('a' - 'A');
+
+    while (block >= 32 && needle_idx >= 0) {
+        unsigned int candidates = 0xffffffff; // Bits still eligible in this block.
+        __m256i bytes;
+
+        block -= 32;
+        bytes = _mm256_loadu_si256((const __m256i *)(haystack_p + block));
+        if (!case_sensitive) {
+            __m256i is_upper = _mm256_and_si256(
+                _mm256_cmpgt_epi8(bytes, upper_min),
+                _mm256_cmpgt_epi8(upper_max, bytes)
+            );
+            bytes = _mm256_or_si256(bytes, _mm256_and_si256(is_upper, case_bit));
+        }
+
+        // Find as many needle characters as possible within this block.
+        while (needle_idx >= 0) {
+            unsigned int found = candidates & (unsigned int)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(needle_p[needle_idx]))
+            );
+            int bit;
+            if (!found) {
+                break;
+            }
+            bit = 31 - __builtin_clz(found);
+            rightmost_match_p[needle_idx--] = block + bit;
+            candidates = (1u << bit) - 1;
+        }
+    }
+
+    // Finish off any remainder 16 bytes at a time, then byte by byte.
+    needle_idx = prescan_sse2_blocks(
+        haystack_p,
+        &block,
+        needle_p,
+        needle_idx,
+        case_sensitive,
+        rightmost_match_p
+    );
+    return prescan_tail(
+        haystack_p,
+        block,
+        needle_p,
+        needle_idx,
+        case_sensitive,
+        rightmost_match_p
+    ) == -1;
+}
+
+#endif
+
+/**
+ * Selects the best implementation supported by the CPU we're running on.
+ */
+void prescan_init(void) {
+#ifdef PRESCAN_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        prescan = prescan_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        prescan = prescan_sse2;
+    }
+#endif
+}
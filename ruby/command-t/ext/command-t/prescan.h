@@ -0,0 +1,31 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * Reverse pre-scan of a haystack, recording the rightmost position at which
+ * each needle character can match (such that all subsequent needle characters
+ * can still match after it).
+ *
+ * Returns 1 if the entire needle was found, 0 otherwise.
+ */
+typedef int (*prescan_t)(
+    const char *haystack_p,
+    long haystack_len,
+    const char *needle_p,
+    long needle_len,
+    int case_sensitive,
+    long *rightmost_match_p
+);
+
+// Best available implementation for the current CPU; set by prescan_init().
+extern prescan_t prescan;
+
+void prescan_init(void);
+int prescan_scalar(
+    const char *haystack_p,
+    long haystack_len,
+    const char *needle_p,
+    long needle_len,
+    int case_sensitive,
+    long *rightmost_match_p
+);
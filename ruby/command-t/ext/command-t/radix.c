@@ -0,0 +1,198 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+#include <errno.h>  /* for ENOMEM */
+#include <stdlib.h> /* for free(), malloc(), NULL */
+#include <string.h> /* for memcpy(), memset() */
+
+// order matters; we want HAVE_PTHREAD_H to be evaluated only after ruby.h
+#include <ruby.h>
+#include "pool.h"
+#include "radix.h"
+
+#define RADIX_BUCKETS 256
+#define RADIX_PASSES 8
+
+typedef struct {
+    const uint64_t *from;
+    uint64_t *to;
+    long start;
+    long end;
+    int shift;
+    long counts[RADIX_BUCKETS]; // Digit counts, then scatter offsets.
+} radix_part_t;
+
+// Calls `job` for each of `part_count` parts, returning 0 on success, or an
+// error number.
+typedef int (*radix_runner_t)(
+    void *context,
+    void *(*job)(void *),
+    radix_part_t *parts,
+    long part_count
+);
+
+static void *radix_count(void *arg) {
+    long i;
+    radix_part_t *part = (radix_part_t *)arg;
+
+    memset(part->counts, 0, sizeof(part->counts));
+    for (i = part->start; i < part->end; i++) {
+        part->counts[(part->from[i] >> part->shift) & 0xff]++;
+    }
+    return NULL;
+}
+
+static void *radix_scatter(void *arg) {
+    long i;
+    radix_part_t *part = (radix_part_t *)arg;
+
+    for (i = part->start; i < part->end; i++) {
+        part->to[part->counts[(part->from[i] >> part->shift) & 0xff]++] =
+            part->from[i];
+    }
+    return NULL;
+}
+
+static int radix_run_serially(
+    void *context,
+    void *(*job)(void *),
+    radix_part_t *parts,
+    long part_count
+) {
+    long i;
+    for (i = 0; i < part_count; i++) {
+        job(&parts[i]);
+    }
+    return 0;
+}
+
+static int radix_sort_parts(
+    uint64_t *keys,
+    long count,
+    long part_count,
+    radix_runner_t run,
+    void *context
+) {
+    int err = 0;
+    int pass, bucket;
+    long i, offset, total;
+    uint64_t *from = keys;
+    uint64_t *to;
+    uint64_t *swap;
+    radix_part_t *parts;
+
+    to = malloc((count ? count : 1) * sizeof(uint64_t));
+    parts = malloc(part_count * sizeof(radix_part_t));
+    if (!to || !parts) {
+        free(to);
+        free(parts);
+        return ENOMEM;
+    }
+
+    for (pass = 0; pass < RADIX_PASSES; pass++) {
+        for (i = 0; i < part_count; i++) {
+            parts[i].from = from;
+            parts[i].to = to;
+            parts[i].start = count * i / part_count;
+            parts[i].end = count * (i + 1) / part_count;
+            parts[i].shift = pass * 8;
+        }
+        err = run(context, radix_count, parts, part_count);
+        if (err) {
+            break;
+        }
+
+        // Skip the pass if every key has the same digit.
+        for (bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+            for (i = 0, total = 0; i < part_count; i++) {
+                total += parts[i].counts[bucket];
+            }
+            if (total) {
+                break;
+            }
+        }
+        if (total == count) {
+            continue;
+        }
+
+        // Turn counts into offsets: all keys with a smaller digit come
+        // first, followed by those with the same digit in earlier parts
+        // (which keeps the sort stable).
+        for (bucket = 0, offset = 0; bucket < RADIX_BUCKETS; bucket++) {
+            for (i = 0; i < part_count; i++) {
+                total = parts[i].counts[bucket];
+                parts[i].counts[bucket] = offset;
+                offset += total;
+            }
+        }
+
+        err = run(context, radix_scatter, parts, part_count);
+        if (err) {
+            break;
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (!err && from != keys) {
+        memcpy(keys, from, count * sizeof(uint64_t));
+    }
+    free(from == keys ? to : from);
+    free(parts);
+    return err;
+}
+
+/**
+ * Sorts `count` keys into ascending order.
+ *
+ * Returns 0 on success, or an error number (in which case the keys are left
+ * in an unspecified order).
+ */
+int radix_sort(uint64_t *keys, long count) {
+    return radix_sort_parts(keys, count, 1, radix_run_serially, NULL);
+}
+
+#ifdef HAVE_PTHREAD_H
+static int radix_run_in_pool(
+    void *context,
+    void *(*job)(void *),
+    radix_part_t *parts,
+    long part_count
+) {
+    int err;
+    void **results = malloc(part_count * sizeof(void *));
+
+    if (!results) {
+        return ENOMEM;
+    }
+    err = pool_run(
+        (pool_t *)context,
+        part_count,
+        job,
+        parts,
+        sizeof(radix_part_t),
+        results
+    );
+    free(results);
+    return err;
+}
+
+/**
+ * Like `radix_sort()`, but uses `thread_count` threads from `pool`.
+ */
+int radix_sort_parallel(
+    uint64_t *keys,
+    long count,
+    pool_t *pool,
+    long thread_count
+) {
+    return radix_sort_parts(
+        keys,
+        count,
+        thread_count,
+        radix_run_in_pool,
+        pool
+    );
+}
+#endif
@@ -0,0 +1,25 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * Least-significant-digit radix sort of 64-bit keys, one byte per pass.
+ *
+ * The keys are split into contiguous parts, each of which is counted and
+ * then scattered independently, so that the parts can be handled by
+ * different threads; passes in which every key has the same digit are
+ * skipped.
+ *
+ * Include pool.h first for `radix_sort_parallel()`.
+ */
+
+#include <stdint.h> /* for uint64_t */
+
+int radix_sort(uint64_t *keys, long count);
+#ifdef HAVE_PTHREAD_H
+int radix_sort_parallel(
+    uint64_t *keys,
+    long count,
+    pool_t *pool,
+    long thread_count
+);
+#endif
@@ -27,3 +27,16 @@
 #ifndef RFLOAT_VALUE
 #define RFLOAT_VALUE(f) (RFLOAT(f)->value)
 #endif
+
+// for compatibility with older versions of Ruby which don't declare RB_GC_GUARD
+#ifndef RB_GC_GUARD
+#define RB_GC_GUARD(v) (*(volatile VALUE *)&(v))
+#endif
+
+// for compatibility with older versions of Ruby which don't declare ALLOCV_N
+// (a String serves as the garbage-collected buffer)
+#ifndef ALLOCV_N
+#define ALLOCV_N(type, v, n) \
+    ((type *)RSTRING_PTR((v) = rb_str_new(NULL, sizeof(type) * (n))))
+#define ALLOCV_END(v) RB_GC_GUARD(v)
+#endif
@@ -0,0 +1,128 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+#include <stdlib.h> /* for calloc(), free(), malloc(), realloc(), NULL */
+#include <string.h> /* for memset() */
+
+#include "scratch.h"
+
+/**
+ * Returns a new, empty scratch arena, or NULL on failure.
+ */
+scratch_t *scratch_new(void) {
+    scratch_t *scratch = calloc(1, sizeof(scratch_t));
+    if (!scratch) {
+        return NULL;
+    }
+
+    // Cells start out zeroed, so generation 0 must never be "current".
+    scratch->generation = 1;
+    return scratch;
+}
+
+/**
+ * Frees a previously created scratch arena.
+ */
+void scratch_free(scratch_t *scratch) {
+    free(scratch->memo);
+    free(scratch->rightmost_match_p);
+    free(scratch->row_scores);
+    free(scratch->haystack_w);
+    free(scratch->folded_w);
+    free(scratch->offsets);
+    free(scratch);
+}
+
+/**
+ * Ensures there is per-needle-character storage for at least `needle_len`
+ * characters. Returns 0 (and marks the arena as failed) on failure.
+ */
+int scratch_reserve_needle(scratch_t *scratch, long needle_len) {
+    if (needle_len > scratch->needle_capacity) {
+        long *rightmost_match_p;
+        float *row_scores;
+
+        rightmost_match_p = realloc(
+            scratch->rightmost_match_p,
+            needle_len * sizeof(long)
+        );
+        if (!rightmost_match_p) {
+            scratch->failed = 1;
+            return 0;
+        }
+        scratch->rightmost_match_p = rightmost_match_p;
+
+        row_scores = realloc(scratch->row_scores, needle_len * sizeof(float));
+        if (!row_scores) {
+            scratch->failed = 1;
+            return 0;
+        }
+        scratch->row_scores = row_scores;
+        scratch->needle_capacity = needle_len;
+    }
+    return 1;
+}
+
+/**
+ * Ensures there is per-haystack-character storage (for decoded UTF-8) for at
+ * least `haystack_len` characters. Returns 0 (and marks the arena as failed)
+ * on failure.
+ */
+int scratch_reserve_haystack(scratch_t *scratch, long haystack_len) {
+    if (haystack_len > scratch->haystack_capacity) {
+        // Any existing contents are garbage, so don't bother with realloc().
+        free(scratch->haystack_w);
+        free(scratch->folded_w);
+        free(scratch->offsets);
+        scratch->haystack_w = malloc(haystack_len * sizeof(uint32_t));
+        scratch->folded_w = malloc(haystack_len * sizeof(uint32_t));
+        scratch->offsets = malloc(haystack_len * sizeof(long));
+        if (!scratch->haystack_w || !scratch->folded_w || !scratch->offsets) {
+            free(scratch->haystack_w);
+            free(scratch->folded_w);
+            free(scratch->offsets);
+            scratch->haystack_w = scratch->folded_w = NULL;
+            scratch->offsets = NULL;
+            scratch->haystack_capacity = 0;
+            scratch->failed = 1;
+            return 0;
+        }
+        scratch->haystack_capacity = haystack_len;
+    }
+    return 1;
+}
+
+/**
+ * Returns a memo table of at least `memo_size` cells, all of which are unset,
+ * or NULL (marking the arena as failed) on failure.
+ *
+ * This is O(1) except when the table needs to grow, or on the (rare)
+ * occasions that the generation counter wraps around.
+ */
+memo_cell_t *scratch_reset_memo(scratch_t *scratch, long memo_size) {
+    if (memo_size > scratch->memo_capacity) {
+        // Grow geometrically to amortize the cost over many candidates.
+        long capacity = scratch->memo_capacity * 2;
+        if (capacity < memo_size) {
+            capacity = memo_size;
+        }
+
+        // Any existing contents are garbage, so don't bother with realloc().
+        free(scratch->memo);
+        scratch->memo = calloc(capacity, sizeof(memo_cell_t));
+        if (!scratch->memo) {
+            scratch->memo_capacity = 0;
+            scratch->failed = 1;
+            return NULL;
+        }
+        scratch->memo_capacity = capacity;
+    }
+
+    scratch->generation++;
+    if (scratch->generation == 0) {
+        // Wrapped around: stale stamps could now look current, so clear them.
+        memset(scratch->memo, 0, scratch->memo_capacity * sizeof(memo_cell_t));
+        scratch->generation = 1;
+    }
+    return scratch->memo;
+}
@@ -0,0 +1,37 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * A reusable, growable per-thread scratch arena for the scorer.
+ *
+ * Memo cells are stamped with the generation in which they were written, so
+ * invalidating the whole memo table between candidates is just a matter of
+ * bumping the generation.
+ */
+
+#include <stdint.h> /* for uint32_t */
+
+typedef struct {
+    float score;
+    uint32_t generation;
+} memo_cell_t;
+
+typedef struct {
+    memo_cell_t *memo;
+    long memo_capacity;
+    long *rightmost_match_p;
+    float *row_scores;
+    long needle_capacity;
+    uint32_t *haystack_w; // Decoded haystack codepoints (UTF-8 mode).
+    uint32_t *folded_w;   // Same, case-folded if appropriate.
+    long *offsets;        // Byte offset of each codepoint.
+    long haystack_capacity;
+    uint32_t generation;
+    int failed; // Boolean: set if an allocation failed.
+} scratch_t;
+
+scratch_t *scratch_new(void);
+void scratch_free(scratch_t *scratch);
+int scratch_reserve_needle(scratch_t *scratch, long needle_len);
+int scratch_reserve_haystack(scratch_t *scratch, long haystack_len);
+memo_cell_t *scratch_reset_memo(scratch_t *scratch, long memo_size);
@@ -0,0 +1,228 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+#include <stdlib.h> /* for calloc(), free(), malloc(), posix_memalign() */
+#include <string.h> /* for memcpy(), memset() */
+
+#include "store.h"
+#include "ruby_compat.h"
+
+#define STORE_PADDED(len) (((len) + 3) & ~3L)
+
+// Arrays which matcher threads write to are cache-line aligned, so that
+// threads working on different chunks (see matcher.c) don't share lines.
+#define STORE_ALIGNMENT 64
+
+static void *store_alloc(size_t size) {
+#ifdef HAVE_POSIX_MEMALIGN
+    void *ptr;
+    return posix_memalign(&ptr, STORE_ALIGNMENT, size) ? NULL : ptr;
+#else
+    return malloc(size);
+#endif
+}
+
+/**
+ * Returns a new store containing copies of the strings in the `paths` array,
+ * or NULL on failure.
+ *
+ * Bitmasks, flags and boundary classes are left for the caller to fill in
+ * (setting `prepared` once done), as is the ranking (see `store_rank_part()`
+ * and `store_rank_merge()`, setting `ranked_prepared` once done); scores are
+ * zeroed.
+ */
+store_t *store_new(VALUE paths) {
+    long i, offset;
+    long count = RARRAY_LEN(paths);
+    long size = 0;
+    VALUE path;
+    store_t *store = calloc(1, sizeof(store_t));
+
+    if (!store) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        size += STORE_PADDED(RSTRING_LEN(RARRAY_PTR(paths)[i]));
+    }
+
+    store->count = count;
+    store->bytes = malloc(size ? size : 1);
+    store->boundaries = malloc(size ? size / 4 : 1);
+    store->offsets = malloc((count ? count : 1) * sizeof(long));
+    store->lengths = malloc((count ? count : 1) * sizeof(long));
+    store->bitmasks = store_alloc((count ? count : 1) * sizeof(uint64_t));
+    store->flags = store_alloc((count ? count : 1) * sizeof(uint32_t));
+    store->scores = store_alloc((count ? count : 1) * sizeof(float));
+    store->ranked = malloc((count ? count : 1) * sizeof(uint32_t));
+    store->ranks = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (
+        !store->bytes ||
+        !store->boundaries ||
+        !store->offsets ||
+        !store->lengths ||
+        !store->bitmasks ||
+        !store->flags ||
+        !store->scores ||
+        !store->ranked ||
+        !store->ranks
+    ) {
+        store_free(store);
+        return NULL;
+    }
+    memset(store->scores, 0, count * sizeof(float));
+
+    for (i = 0, offset = 0; i < count; i++) {
+        path = RARRAY_PTR(paths)[i];
+        store->offsets[i] = offset;
+        store->lengths[i] = RSTRING_LEN(path);
+        memcpy(store->bytes + offset, RSTRING_PTR(path), store->lengths[i]);
+        memset(
+            store->bytes + offset + store->lengths[i],
+            0,
+            STORE_PADDED(store->lengths[i]) - store->lengths[i]
+        );
+        offset += STORE_PADDED(store->lengths[i]);
+    }
+    return store;
+}
+
+// Returns 1 if path `a` sorts before path `b` byte-wise (with the shorter of
+// two otherwise equal paths first).
+static inline int store_before(const store_t *store, uint32_t a, uint32_t b) {
+    long a_len = store->lengths[a];
+    long b_len = store->lengths[b];
+    int order = memcmp(
+        STORE_PATH(store, a),
+        STORE_PATH(store, b),
+        a_len < b_len ? a_len : b_len
+    );
+    return order ? order < 0 : a_len < b_len;
+}
+
+// Merges the sorted indices in `from[start..middle)` and `from[middle..end)`
+// into `to[start..end)`. Equal paths keep their order, so that duplicates
+// are ranked by index.
+static void store_merge(
+    const store_t *store,
+    const uint32_t *from,
+    uint32_t *to,
+    long start,
+    long middle,
+    long end
+) {
+    long i = start;
+    long j = middle;
+    long k = start;
+
+    while (i < middle && j < end) {
+        to[k++] = store_before(store, from[j], from[i]) ? from[j++] : from[i++];
+    }
+    while (i < middle) {
+        to[k++] = from[i++];
+    }
+    while (j < end) {
+        to[k++] = from[j++];
+    }
+}
+
+// Start of part `part` of `part_count` roughly equal parts of the store.
+#define STORE_PART(store, part, part_count) \
+    ((store)->count * (part) / (part_count))
+
+// Paths are insertion-sorted in runs of this many before merging.
+#define STORE_RUN 16
+
+/**
+ * Sorts part `part` of `part_count` roughly equal parts of `store->ranked`
+ * (see `store_rank_merge()`), using the same part of `store->ranks` as
+ * scratch space. Doesn't touch any Ruby objects, and different parts may be
+ * sorted concurrently.
+ */
+void store_rank_part(store_t *store, long part, long part_count) {
+    long i, j, run, width, middle, end;
+    uint32_t index;
+    long start = STORE_PART(store, part, part_count);
+    long stop = STORE_PART(store, part + 1, part_count);
+    uint32_t *from = store->ranked;
+    uint32_t *to = store->ranks;
+    uint32_t *swap;
+
+    for (i = start; i < stop; i++) {
+        run = start + (i - start) / STORE_RUN * STORE_RUN;
+        index = i;
+        for (j = i; j > run && store_before(store, index, from[j - 1]); j--) {
+            from[j] = from[j - 1];
+        }
+        from[j] = index;
+    }
+    for (width = STORE_RUN; width < stop - start; width *= 2) {
+        for (i = start; i < stop; i += 2 * width) {
+            middle = i + width < stop ? i + width : stop;
+            end = i + 2 * width < stop ? i + 2 * width : stop;
+            store_merge(store, from, to, i, middle, end);
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != store->ranked) {
+        memcpy(
+            store->ranked + start,
+            from + start,
+            (stop - start) * sizeof(uint32_t)
+        );
+    }
+}
+
+/**
+ * Completes the ranking begun by sorting each of the `part_count` parts of
+ * the store with `store_rank_part()`: merges the parts to give
+ * `store->ranked`, the indices of the paths in lexicographic order, and fills
+ * in its inverse, `store->ranks`. Doesn't touch any Ruby objects.
+ */
+void store_rank_merge(store_t *store, long part_count) {
+    long i, width, middle, end;
+    uint32_t *from = store->ranked;
+    uint32_t *to = store->ranks;
+    uint32_t *swap;
+
+    for (width = 1; width < part_count; width *= 2) {
+        for (i = 0; i < part_count; i += 2 * width) {
+            middle = i + width < part_count ? i + width : part_count;
+            end = i + 2 * width < part_count ? i + 2 * width : part_count;
+            store_merge(
+                store,
+                from,
+                to,
+                STORE_PART(store, i, part_count),
+                STORE_PART(store, middle, part_count),
+                STORE_PART(store, end, part_count)
+            );
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != store->ranked) {
+        memcpy(store->ranked, from, store->count * sizeof(uint32_t));
+    }
+    for (i = 0; i < store->count; i++) {
+        store->ranks[store->ranked[i]] = i;
+    }
+}
+
+/**
+ * Frees a previously created store.
+ */
+void store_free(store_t *store) {
+    free(store->bytes);
+    free(store->offsets);
+    free(store->lengths);
+    free(store->bitmasks);
+    free(store->flags);
+    free(store->boundaries);
+    free(store->scores);
+    free(store->ranked);
+    free(store->ranks);
+    free(store);
+}
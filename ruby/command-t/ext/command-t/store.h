@@ -0,0 +1,72 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * A native copy of a set of paths, built once per set, in
+ * structure-of-arrays layout so that matcher threads can stream through it
+ * without touching any Ruby objects.
+ *
+ * Path bytes are stored back to back in a single arena, each padded to a
+ * multiple of 4 bytes so that its boundary classes (see match.h), packed four
+ * to a byte, can be found at `boundaries + offsets[i] / 4`.
+ *
+ * Each path can also be given a rank, its position in lexicographic order, so
+ * that ties between equal scores can be broken without comparing path bytes.
+ * Ranking is only worth it for searches which sort all of their matches (see
+ * matcher.c), so it is done on demand.
+ */
+
+#include <ruby.h>
+#include <stdint.h> /* for uint32_t, uint64_t */
+#include <string.h> /* for memcmp() */
+
+typedef struct {
+    long count;
+    char *bytes;               // All paths, back to back (see above).
+    long *offsets;             // Of each path within `bytes`.
+    long *lengths;             // Of each path, in bytes.
+    uint64_t *bitmasks;        // Character classes present in each path.
+    uint32_t *flags;           // Haystack flags (see match.h) for each path.
+    unsigned char *boundaries; // Boundary classes for each path.
+    float *scores;             // Score of each path in the most recent search.
+    int prepared;              // Set once bitmasks, flags and boundaries are.
+    int ranked_prepared;       // Set once ranked and ranks are.
+    uint32_t *ranked;          // Indices in lexicographic order.
+    uint32_t *ranks;           // Position of each path in `ranked`.
+} store_t;
+
+#define STORE_PATH(store, i) ((store)->bytes + (store)->offsets[i])
+#define STORE_BOUNDARIES(store, i) \
+    ((store)->boundaries + (store)->offsets[i] / 4)
+
+// Compares paths `a` and `b` in lexicographic order: byte-wise, with the
+// shorter of two otherwise equal paths first, and duplicates in index order.
+// Uses their ranks once the store has been ranked.
+static inline int store_compare(const store_t *store, uint32_t a, uint32_t b) {
+    long a_len, b_len;
+    int order;
+
+    if (store->ranked_prepared) {
+        return store->ranks[a] < store->ranks[b] ? -1 :
+            store->ranks[a] > store->ranks[b];
+    }
+    a_len = store->lengths[a];
+    b_len = store->lengths[b];
+    order = memcmp(
+        STORE_PATH(store, a),
+        STORE_PATH(store, b),
+        a_len < b_len ? a_len : b_len
+    );
+    if (order == 0) {
+        order = a_len < b_len ? -1 : a_len > b_len;
+    }
+    if (order == 0) {
+        order = a < b ? -1 : a > b;
+    }
+    return order;
+}
+
+store_t *store_new(VALUE paths);
+void store_free(store_t *store);
+void store_rank_part(store_t *store, long part, long part_count);
+void store_rank_merge(store_t *store, long part_count);
@@ -0,0 +1,127 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+#include <stdlib.h> /* for calloc(), free(), malloc() */
+#include <string.h> /* for memcmp(), memcpy(), memmove() */
+
+#include "survivors.h"
+
+static void survivors_free(survivors_t *survivors) {
+    free(survivors->needle);
+    free(survivors->indices);
+}
+
+/**
+ * Returns a new, empty stack holding at most `max_depth` lists, or NULL on
+ * failure.
+ */
+survivor_stack_t *survivor_stack_new(long max_depth) {
+    survivor_stack_t *stack = malloc(sizeof(survivor_stack_t));
+    if (!stack) {
+        return NULL;
+    }
+    stack->levels = calloc(max_depth ? max_depth : 1, sizeof(survivors_t));
+    if (!stack->levels) {
+        free(stack);
+        return NULL;
+    }
+    stack->depth = 0;
+    stack->max_depth = max_depth;
+    stack->key = 0;
+    return stack;
+}
+
+/**
+ * Frees a previously created stack, along with its lists.
+ */
+void survivor_stack_free(survivor_stack_t *stack) {
+    survivor_stack_clear(stack);
+    free(stack->levels);
+    free(stack);
+}
+
+/**
+ * Discards all lists (eg. because the paths changed).
+ */
+void survivor_stack_clear(survivor_stack_t *stack) {
+    while (stack->depth) {
+        survivors_free(&stack->levels[--stack->depth]);
+    }
+}
+
+/**
+ * Pops every list whose needle isn't a prefix of `needle`, and returns the
+ * list now on top (or NULL if the stack is empty).
+ *
+ * If `key` differs from that of the lists on the stack, they are all popped,
+ * and subsequently pushed lists are recorded as being valid for `key`.
+ */
+survivors_t *survivor_stack_find(
+    survivor_stack_t *stack,
+    int key,
+    const char *needle,
+    long needle_length
+) {
+    survivors_t *top;
+    if (key != stack->key) {
+        survivor_stack_clear(stack);
+        stack->key = key;
+    }
+    while (stack->depth) {
+        top = &stack->levels[stack->depth - 1];
+        if (
+            top->needle_length <= needle_length &&
+            memcmp(top->needle, needle, top->needle_length) == 0
+        ) {
+            return top;
+        }
+        survivors_free(top);
+        stack->depth--;
+    }
+    return NULL;
+}
+
+/**
+ * Pushes the `count` surviving `indices` (which the stack takes ownership of)
+ * for `needle`, which must extend the needle on top of the stack. If the stack
+ * is full, the bottom list is discarded to make room.
+ *
+ * Returns 0 on failure (in which case `indices` is freed).
+ */
+int survivor_stack_push(
+    survivor_stack_t *stack,
+    const char *needle,
+    long needle_length,
+    uint32_t *indices,
+    long count
+) {
+    survivors_t *survivors;
+    char *copy;
+
+    if (stack->max_depth == 0) {
+        free(indices);
+        return 1;
+    }
+    copy = malloc(needle_length ? needle_length : 1);
+    if (!copy) {
+        free(indices);
+        return 0;
+    }
+    memcpy(copy, needle, needle_length);
+
+    if (stack->depth == stack->max_depth) {
+        survivors_free(&stack->levels[0]);
+        memmove(
+            &stack->levels[0],
+            &stack->levels[1],
+            (stack->depth - 1) * sizeof(survivors_t)
+        );
+        stack->depth--;
+    }
+    survivors = &stack->levels[stack->depth++];
+    survivors->needle = copy;
+    survivors->needle_length = needle_length;
+    survivors->indices = indices;
+    survivors->count = count;
+    return 1;
+}
@@ -0,0 +1,51 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * A bounded stack of survivor lists: for each of a chain of successively
+ * longer needles (each a prefix of the next), the indices of the paths which
+ * weren't ruled out by that needle.
+ *
+ * A path ruled out by a needle can't match any needle which extends it, so
+ * a search only needs to look at the survivors of the longest stacked needle
+ * which is a prefix of its own, whether the user typed another character or
+ * deleted one. Paths merely hidden by the dot-file rules aren't ruled out
+ * (see `HIDDEN_SCORE` in matcher.c), so the results don't depend on which
+ * searches came before.
+ *
+ * Lists are only valid for the search options (eg. case sensitivity) they
+ * were computed with, which are recorded as an opaque `key`.
+ */
+
+#include <stdint.h> /* for uint32_t */
+
+typedef struct {
+    char *needle;       // Compiled needle bytes.
+    long needle_length;
+    uint32_t *indices;  // Of surviving paths, in ascending order.
+    long count;
+} survivors_t;
+
+typedef struct {
+    survivors_t *levels; // Bottom (shortest needle) first.
+    long depth;
+    long max_depth;
+    int key;             // Search options which the lists are valid for.
+} survivor_stack_t;
+
+survivor_stack_t *survivor_stack_new(long max_depth);
+void survivor_stack_free(survivor_stack_t *stack);
+void survivor_stack_clear(survivor_stack_t *stack);
+survivors_t *survivor_stack_find(
+    survivor_stack_t *stack,
+    int key,
+    const char *needle,
+    long needle_length
+);
+int survivor_stack_push(
+    survivor_stack_t *stack,
+    const char *needle,
+    long needle_length,
+    uint32_t *indices,
+    long count
+);
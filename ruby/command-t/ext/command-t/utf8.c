@@ -0,0 +1,113 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+#include "utf8.h"
+#include "utf8_fold.h"
+
+#define CONTINUATION(byte) (((byte) & 0xc0) == 0x80)
+#define ESCAPE(byte) (0xdc00 + (byte))
+
+/**
+ * Decodes the codepoint at the start of the `len` bytes at `p` into
+ * `codepoint`, returning the number of bytes consumed (always at least 1).
+ */
+long utf8_decode(const char *p, long len, uint32_t *codepoint) {
+    const unsigned char *s = (const unsigned char *)p;
+    unsigned char lead = s[0];
+
+    if (lead < 0x80) {
+        *codepoint = lead;
+        return 1;
+    } else if (lead >= 0xc2 && lead <= 0xdf) {
+        if (len >= 2 && CONTINUATION(s[1])) {
+            *codepoint = ((lead & 0x1f) << 6) | (s[1] & 0x3f);
+            return 2;
+        }
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        if (
+            len >= 3 &&
+            CONTINUATION(s[1]) &&
+            CONTINUATION(s[2]) &&
+            (lead != 0xe0 || s[1] >= 0xa0) && // Overlong.
+            (lead != 0xed || s[1] < 0xa0)     // Surrogate.
+        ) {
+            *codepoint =
+                ((lead & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+            return 3;
+        }
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        if (
+            len >= 4 &&
+            CONTINUATION(s[1]) &&
+            CONTINUATION(s[2]) &&
+            CONTINUATION(s[3]) &&
+            (lead != 0xf0 || s[1] >= 0x90) && // Overlong.
+            (lead != 0xf4 || s[1] < 0x90)     // Beyond U+10FFFF.
+        ) {
+            *codepoint =
+                ((lead & 0x07) << 18) | ((s[1] & 0x3f) << 12) |
+                ((s[2] & 0x3f) << 6) | (s[3] & 0x3f);
+            return 4;
+        }
+    }
+    *codepoint = ESCAPE(lead);
+    return 1;
+}
+
+/**
+ * Writes the encoding of `codepoint` to `out` (which must have room for 4
+ * bytes), returning the number of bytes written.
+ */
+int utf8_encode(uint32_t codepoint, char *out) {
+    if (codepoint < 0x80) {
+        out[0] = codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        out[0] = 0xc0 | (codepoint >> 6);
+        out[1] = 0x80 | (codepoint & 0x3f);
+        return 2;
+    } else if (codepoint >= ESCAPE(0x80) && codepoint <= ESCAPE(0xff)) {
+        out[0] = codepoint - ESCAPE(0);
+        return 1;
+    } else if (codepoint < 0x10000) {
+        out[0] = 0xe0 | (codepoint >> 12);
+        out[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        out[2] = 0x80 | (codepoint & 0x3f);
+        return 3;
+    } else {
+        out[0] = 0xf0 | (codepoint >> 18);
+        out[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+        out[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+        out[3] = 0x80 | (codepoint & 0x3f);
+        return 4;
+    }
+}
+
+/**
+ * Returns the simple case folding of `codepoint`.
+ */
+uint32_t utf8_fold(uint32_t codepoint) {
+    long low = 0;
+    long high = sizeof(utf8_fold_ranges) / sizeof(utf8_fold_ranges[0]) - 1;
+
+    if (codepoint < 0x80) {
+        return codepoint >= 'A' && codepoint <= 'Z' ?
+            codepoint + ('a' - 'A') :
+            codepoint;
+    }
+    while (low <= high) {
+        long mid = (low + high) / 2;
+        const utf8_fold_range_t *range = &utf8_fold_ranges[mid];
+        if (codepoint < range->first) {
+            high = mid - 1;
+        } else if (codepoint > range->last) {
+            low = mid + 1;
+        } else {
+            if ((codepoint - range->first) % range->stride == 0) {
+                return codepoint + range->delta;
+            }
+            break;
+        }
+    }
+    return codepoint;
+}
@@ -0,0 +1,24 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+/**
+ * Just enough UTF-8 support for the scorer: decoding, encoding and Unicode
+ * simple case folding.
+ *
+ * Bytes that aren't part of a valid UTF-8 sequence decode to a codepoint in
+ * the (otherwise unused) range U+DC80 to U+DCFF, and encode back to the
+ * original byte, so arbitrary byte strings survive a round trip.
+ */
+
+#include <stdint.h> /* for uint32_t, int32_t */
+
+typedef struct {
+    uint32_t first;  // First codepoint in range.
+    uint32_t last;   // Last codepoint in range.
+    int32_t delta;   // Offset from each codepoint to its folded equivalent.
+    uint32_t stride; // 1 if every codepoint in range folds, 2 if every other.
+} utf8_fold_range_t;
+
+long utf8_decode(const char *p, long len, uint32_t *codepoint);
+int utf8_encode(uint32_t codepoint, char *out);
+uint32_t utf8_fold(uint32_t codepoint);
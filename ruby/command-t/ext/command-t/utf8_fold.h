@@ -0,0 +1,208 @@
+// Copyright 2017-present Greg Hurrell. All rights reserved.
+// Licensed under the terms of the BSD 2-clause license.
+
+// Generated by `rake fold_table` (Unicode 15.0.0); do not edit.
+
+static const utf8_fold_range_t utf8_fold_ranges[] = {
+    { 0x000b5, 0x000b5,    775, 1 },
+    { 0x000c0, 0x000d6,     32, 1 },
+    { 0x000d8, 0x000de,     32, 1 },
+    { 0x00100, 0x0012e,      1, 2 },
+    { 0x00132, 0x00136,      1, 2 },
+    { 0x00139, 0x00147,      1, 2 },
+    { 0x0014a, 0x00176,      1, 2 },
+    { 0x00178, 0x00178,   -121, 1 },
+    { 0x00179, 0x0017d,      1, 2 },
+    { 0x0017f, 0x0017f,   -268, 1 },
+    { 0x00181, 0x00181,    210, 1 },
+    { 0x00182, 0x00184,      1, 2 },
+    { 0x00186, 0x00186,    206, 1 },
+    { 0x00187, 0x00187,      1, 1 },
+    { 0x00189, 0x0018a,    205, 1 },
+    { 0x0018b, 0x0018b,      1, 1 },
+    { 0x0018e, 0x0018e,     79, 1 },
+    { 0x0018f, 0x0018f,    202, 1 },
+    { 0x00190, 0x00190,    203, 1 },
+    { 0x00191, 0x00191,      1, 1 },
+    { 0x00193, 0x00193,    205, 1 },
+    { 0x00194, 0x00194,    207, 1 },
+    { 0x00196, 0x00196,    211, 1 },
+    { 0x00197, 0x00197,    209, 1 },
+    { 0x00198, 0x00198,      1, 1 },
+    { 0x0019c, 0x0019c,    211, 1 },
+    { 0x0019d, 0x0019d,    213, 1 },
+    { 0x0019f, 0x0019f,    214, 1 },
+    { 0x001a0, 0x001a4,      1, 2 },
+    { 0x001a6, 0x001a6,    218, 1 },
+    { 0x001a7, 0x001a7,      1, 1 },
+    { 0x001a9, 0x001a9,    218, 1 },
+    { 0x001ac, 0x001ac,      1, 1 },
+    { 0x001ae, 0x001ae,    218, 1 },
+    { 0x001af, 0x001af,      1, 1 },
+    { 0x001b1, 0x001b2,    217, 1 },
+    { 0x001b3, 0x001b5,      1, 2 },
+    { 0x001b7, 0x001b7,    219, 1 },
+    { 0x001b8, 0x001b8,      1, 1 },
+    { 0x001bc, 0x001bc,      1, 1 },
+    { 0x001c4, 0x001c4,      2, 1 },
+    { 0x001c5, 0x001c5,      1, 1 },
+    { 0x001c7, 0x001c7,      2, 1 },
+    { 0x001c8, 0x001c8,      1, 1 },
+    { 0x001ca, 0x001ca,      2, 1 },
+    { 0x001cb, 0x001db,      1, 2 },
+    { 0x001de, 0x001ee,      1, 2 },
+    { 0x001f1, 0x001f1,      2, 1 },
+    { 0x001f2, 0x001f4,      1, 2 },
+    { 0x001f6, 0x001f6,    -97, 1 },
+    { 0x001f7, 0x001f7,    -56, 1 },
+    { 0x001f8, 0x0021e,      1, 2 },
+    { 0x00220, 0x00220,   -130, 1 },
+    { 0x00222, 0x00232,      1, 2 },
+    { 0x0023a, 0x0023a,  10795, 1 },
+    { 0x0023b, 0x0023b,      1, 1 },
+    { 0x0023d, 0x0023d,   -163, 1 },
+    { 0x0023e, 0x0023e,  10792, 1 },
+    { 0x00241, 0x00241,      1, 1 },
+    { 0x00243, 0x00243,   -195, 1 },
+    { 0x00244, 0x00244,     69, 1 },
+    { 0x00245, 0x00245,     71, 1 },
+    { 0x00246, 0x0024e,      1, 2 },
+    { 0x00345, 0x00345,    116, 1 },
+    { 0x00370, 0x00372,      1, 2 },
+    { 0x00376, 0x00376,      1, 1 },
+    { 0x0037f, 0x0037f,    116, 1 },
+    { 0x00386, 0x00386,     38, 1 },
+    { 0x00388, 0x0038a,     37, 1 },
+    { 0x0038c, 0x0038c,     64, 1 },
+    { 0x0038e, 0x0038f,     63, 1 },
+    { 0x00391, 0x003a1,     32, 1 },
+    { 0x003a3, 0x003ab,     32, 1 },
+    { 0x003c2, 0x003c2,      1, 1 },
+    { 0x003cf, 0x003cf,      8, 1 },
+    { 0x003d0, 0x003d0,    -30, 1 },
+    { 0x003d1, 0x003d1,    -25, 1 },
+    { 0x003d5, 0x003d5,    -15, 1 },
+    { 0x003d6, 0x003d6,    -22, 1 },
+    { 0x003d8, 0x003ee,      1, 2 },
+    { 0x003f0, 0x003f0,    -54, 1 },
+    { 0x003f1, 0x003f1,    -48, 1 },
+    { 0x003f4, 0x003f4,    -60, 1 },
+    { 0x003f5, 0x003f5,    -64, 1 },
+    { 0x003f7, 0x003f7,      1, 1 },
+    { 0x003f9, 0x003f9,     -7, 1 },
+    { 0x003fa, 0x003fa,      1, 1 },
+    { 0x003fd, 0x003ff,   -130, 1 },
+    { 0x00400, 0x0040f,     80, 1 },
+    { 0x00410, 0x0042f,     32, 1 },
+    { 0x00460, 0x00480,      1, 2 },
+    { 0x0048a, 0x004be,      1, 2 },
+    { 0x004c0, 0x004c0,     15, 1 },
+    { 0x004c1, 0x004cd,      1, 2 },
+    { 0x004d0, 0x0052e,      1, 2 },
+    { 0x00531, 0x00556,     48, 1 },
+    { 0x010a0, 0x010c5,   7264, 1 },
+    { 0x010c7, 0x010c7,   7264, 1 },
+    { 0x010cd, 0x010cd,   7264, 1 },
+    { 0x013f8, 0x013fd,     -8, 1 },
+    { 0x01c80, 0x01c80,  -6222, 1 },
+    { 0x01c81, 0x01c81,  -6221, 1 },
+    { 0x01c82, 0x01c82,  -6212, 1 },
+    { 0x01c83, 0x01c84,  -6210, 1 },
+    { 0x01c85, 0x01c85,  -6211, 1 },
+    { 0x01c86, 0x01c86,  -6204, 1 },
+    { 0x01c87, 0x01c87,  -6180, 1 },
+    { 0x01c88, 0x01c88,  35267, 1 },
+    { 0x01c90, 0x01cba,  -3008, 1 },
+    { 0x01cbd, 0x01cbf,  -3008, 1 },
+    { 0x01e00, 0x01e94,      1, 2 },
+    { 0x01e9b, 0x01e9b,    -58, 1 },
+    { 0x01e9e, 0x01e9e,  -7615, 1 },
+    { 0x01ea0, 0x01efe,      1, 2 },
+    { 0x01f08, 0x01f0f,     -8, 1 },
+    { 0x01f18, 0x01f1d,     -8, 1 },
+    { 0x01f28, 0x01f2f,     -8, 1 },
+    { 0x01f38, 0x01f3f,     -8, 1 },
+    { 0x01f48, 0x01f4d,     -8, 1 },
+    { 0x01f59, 0x01f5f,     -8, 2 },
+    { 0x01f68, 0x01f6f,     -8, 1 },
+    { 0x01f88, 0x01f8f,     -8, 1 },
+    { 0x01f98, 0x01f9f,     -8, 1 },
+    { 0x01fa8, 0x01faf,     -8, 1 },
+    { 0x01fb8, 0x01fb9,     -8, 1 },
+    { 0x01fba, 0x01fbb,    -74, 1 },
+    { 0x01fbc, 0x01fbc,     -9, 1 },
+    { 0x01fbe, 0x01fbe,  -7173, 1 },
+    { 0x01fc8, 0x01fcb,    -86, 1 },
+    { 0x01fcc, 0x01fcc,     -9, 1 },
+    { 0x01fd8, 0x01fd9,     -8, 1 },
+    { 0x01fda, 0x01fdb,   -100, 1 },
+    { 0x01fe8, 0x01fe9,     -8, 1 },
+    { 0x01fea, 0x01feb,   -112, 1 },
+    { 0x01fec, 0x01fec,     -7, 1 },
+    { 0x01ff8, 0x01ff9,   -128, 1 },
+    { 0x01ffa, 0x01ffb,   -126, 1 },
+    { 0x01ffc, 0x01ffc,     -9, 1 },
+    { 0x02126, 0x02126,  -7517, 1 },
+    { 0x0212a, 0x0212a,  -8383, 1 },
+    { 0x0212b, 0x0212b,  -8262, 1 },
+    { 0x02132, 0x02132,     28, 1 },
+    { 0x02160, 0x0216f,     16, 1 },
+    { 0x02183, 0x02183,      1, 1 },
+    { 0x024b6, 0x024cf,     26, 1 },
+    { 0x02c00, 0x02c2f,     48, 1 },
+    { 0x02c60, 0x02c60,      1, 1 },
+    { 0x02c62, 0x02c62, -10743, 1 },
+    { 0x02c63, 0x02c63,  -3814, 1 },
+    { 0x02c64, 0x02c64, -10727, 1 },
+    { 0x02c67, 0x02c6b,      1, 2 },
+    { 0x02c6d, 0x02c6d, -10780, 1 },
+    { 0x02c6e, 0x02c6e, -10749, 1 },
+    { 0x02c6f, 0x02c6f, -10783, 1 },
+    { 0x02c70, 0x02c70, -10782, 1 },
+    { 0x02c72, 0x02c72,      1, 1 },
+    { 0x02c75, 0x02c75,      1, 1 },
+    { 0x02c7e, 0x02c7f, -10815, 1 },
+    { 0x02c80, 0x02ce2,      1, 2 },
+    { 0x02ceb, 0x02ced,      1, 2 },
+    { 0x02cf2, 0x02cf2,      1, 1 },
+    { 0x0a640, 0x0a66c,      1, 2 },
+    { 0x0a680, 0x0a69a,      1, 2 },
+    { 0x0a722, 0x0a72e,      1, 2 },
+    { 0x0a732, 0x0a76e,      1, 2 },
+    { 0x0a779, 0x0a77b,      1, 2 },
+    { 0x0a77d, 0x0a77d, -35332, 1 },
+    { 0x0a77e, 0x0a786,      1, 2 },
+    { 0x0a78b, 0x0a78b,      1, 1 },
+    { 0x0a78d, 0x0a78d, -42280, 1 },
+    { 0x0a790, 0x0a792,      1, 2 },
+    { 0x0a796, 0x0a7a8,      1, 2 },
+    { 0x0a7aa, 0x0a7aa, -42308, 1 },
+    { 0x0a7ab, 0x0a7ab, -42319, 1 },
+    { 0x0a7ac, 0x0a7ac, -42315, 1 },
+    { 0x0a7ad, 0x0a7ad, -42305, 1 },
+    { 0x0a7ae, 0x0a7ae, -42308, 1 },
+    { 0x0a7b0, 0x0a7b0, -42258, 1 },
+    { 0x0a7b1, 0x0a7b1, -42282, 1 },
+    { 0x0a7b2, 0x0a7b2, -42261, 1 },
+    { 0x0a7b3, 0x0a7b3,    928, 1 },
+    { 0x0a7b4, 0x0a7c2,      1, 2 },
+    { 0x0a7c4, 0x0a7c4,    -48, 1 },
+    { 0x0a7c5, 0x0a7c5, -42307, 1 },
+    { 0x0a7c6, 0x0a7c6, -35384, 1 },
+    { 0x0a7c7, 0x0a7c9,      1, 2 },
+    { 0x0a7d0, 0x0a7d0,      1, 1 },
+    { 0x0a7d6, 0x0a7d8,      1, 2 },
+    { 0x0a7f5, 0x0a7f5,      1, 1 },
+    { 0x0ab70, 0x0abbf, -38864, 1 },
+    { 0x0ff21, 0x0ff3a,     32, 1 },
+    { 0x10400, 0x10427,     40, 1 },
+    { 0x104b0, 0x104d3,     40, 1 },
+    { 0x10570, 0x1057a,     39, 1 },
+    { 0x1057c, 0x1058a,     39, 1 },
+    { 0x1058c, 0x10592,     39, 1 },
+    { 0x10594, 0x10595,     39, 1 },
+    { 0x10c80, 0x10cb2,     64, 1 },
+    { 0x118a0, 0x118bf,     32, 1 },
+    { 0x16e40, 0x16e5f,     32, 1 },
+    { 0x1e900, 0x1e921,     34, 1 },
+};
@@ -2,6 +2,7 @@
 // Licensed under the terms of the BSD 2-clause license.
 
 #include "watchman.h"
+#include "ruby_compat.h"
 
 #ifdef WATCHMAN_BUILD
 
@@ -15,8 +16,8 @@
 
 #include <stdint.h>     /* for uint8_t */
 #include <fcntl.h>      /* for fcntl() */
-#include <sys/errno.h>  /* for errno */
-#include <sys/socket.h> /* for recv(), MSG_PEEK */
+#include <sys/errno.h>  /* for errno, EINTR */
+#include <sys/socket.h> /* for recv(), send() */
 
 typedef struct {
     uint8_t *data;  // payload
@@ -25,7 +26,8 @@ typedef struct {
 } watchman_t;
 
 // Forward declarations:
-VALUE watchman_load(char **ptr, char *end);
+typedef struct watchman_source watchman_source_t;
+VALUE watchman_load(watchman_source_t *s);
 void watchman_dump(watchman_t *w, VALUE serializable);
 
 #define WATCHMAN_DEFAULT_STORAGE 4096
@@ -204,54 +206,127 @@ void watchman_dump(watchman_t *w, VALUE serializable) {
 }
 
 /**
- * Extract and return the int encoded at `ptr`
+ * Helper method for raising a SystemCallError wrapping a lower-level error code
+ * coming from the `errno` global variable.
+ */
+void watchman_raise_system_call_error(int number) {
+    VALUE error = INT2FIX(number);
+    rb_exc_raise(rb_class_new_instance(1, &error, rb_eSystemCallError));
+}
+
+// Size of the buffer through which `CommandTWatchmanUtils_query()` receives
+// the response
+#define WATCHMAN_RECV_BUFFER_SIZE 16384
+
+/**
+ * The bytes which the `watchman_load_*()` functions decode
+ *
+ * These are either an entire serialized object in memory (when `fileno` is -1)
+ * or a response which is still being received from a socket, in which case
+ * `buffer` holds the bytes received so far but not yet decoded; this way, the
+ * response is decoded as it arrives, rather than being held in memory in its
+ * entirety first.
+ */
+struct watchman_source {
+    char *ptr;         // next byte to decode
+    char *end;         // end of the bytes available so far
+    int fileno;        // socket to receive more bytes from (or -1)
+    char *buffer;      // WATCHMAN_RECV_BUFFER_SIZE bytes (socket only)
+    uint64_t pending;  // bytes of the PDU yet to be received (socket only)
+};
+
+/**
+ * Makes sure that at least `len` bytes (at most WATCHMAN_RECV_BUFFER_SIZE) are
+ * available at `s->ptr`, receiving more from the socket if need be, but never
+ * beyond the end of the PDU
+ *
+ * @returns 1 on success, 0 if the input ends first
+ */
+int watchman_source_fill(watchman_source_t *s, size_t len) {
+    size_t space;
+    ssize_t received;
+
+    while ((size_t)(s->end - s->ptr) < len) {
+        if (s->fileno == -1 || !s->pending) {
+            return 0;
+        }
+
+        // move any bytes not yet decoded to the start of the buffer
+        memmove(s->buffer, s->ptr, s->end - s->ptr);
+        s->end = s->buffer + (s->end - s->ptr);
+        s->ptr = s->buffer;
+
+        space = WATCHMAN_RECV_BUFFER_SIZE - (s->end - s->buffer);
+        if (space > s->pending) {
+            space = s->pending;
+        }
+        do {
+            received = recv(s->fileno, s->end, space, 0);
+        } while (received == -1 && errno == EINTR);
+        if (received == -1) {
+            watchman_raise_system_call_error(errno);
+        } else if (received == 0) {
+            rb_raise(rb_eRuntimeError, "failed to load PDU");
+        }
+        s->end += received;
+        s->pending -= received;
+    }
+    return 1;
+}
+
+/**
+ * Extract and return the int encoded at `s->ptr`
  *
- * Moves `ptr` past the extracted int.
+ * Moves `s->ptr` past the extracted int.
  *
  * Will raise an ArgumentError if extracting the int would take us beyond the
- * end of the buffer indicated by `end`, or if there is no int encoded at `ptr`.
+ * end of the input, or if there is no int encoded at `s->ptr`.
  *
  * @returns The extracted int
  */
-int64_t watchman_load_int(char **ptr, char *end) {
-    char *val_ptr = *ptr + sizeof(int8_t);
+int64_t watchman_load_int(watchman_source_t *s) {
+    char *val_ptr;
     int64_t val = 0;
 
-    if (val_ptr >= end) {
+    if (!watchman_source_fill(s, sizeof(int8_t) * 2)) {
         rb_raise(rb_eArgError, "insufficient int storage");
     }
 
-    switch (*ptr[0]) {
+    switch (s->ptr[0]) {
         case WATCHMAN_INT8_MARKER:
-            if (val_ptr + sizeof(int8_t) > end) {
+            if (!watchman_source_fill(s, sizeof(int8_t) + sizeof(int8_t))) {
                 rb_raise(rb_eArgError, "overrun extracting int8_t");
             }
+            val_ptr = s->ptr + sizeof(int8_t);
             val = *(int8_t *)val_ptr;
-            *ptr = val_ptr + sizeof(int8_t);
+            s->ptr = val_ptr + sizeof(int8_t);
             break;
         case WATCHMAN_INT16_MARKER:
-            if (val_ptr + sizeof(int16_t) > end) {
+            if (!watchman_source_fill(s, sizeof(int8_t) + sizeof(int16_t))) {
                 rb_raise(rb_eArgError, "overrun extracting int16_t");
             }
+            val_ptr = s->ptr + sizeof(int8_t);
             val = *(int16_t *)val_ptr;
-            *ptr = val_ptr + sizeof(int16_t);
+            s->ptr = val_ptr + sizeof(int16_t);
             break;
         case WATCHMAN_INT32_MARKER:
-            if (val_ptr + sizeof(int32_t) > end) {
+            if (!watchman_source_fill(s, sizeof(int8_t) + sizeof(int32_t))) {
                 rb_raise(rb_eArgError, "overrun extracting int32_t");
             }
+            val_ptr = s->ptr + sizeof(int8_t);
             val = *(int32_t *)val_ptr;
-            *ptr = val_ptr + sizeof(int32_t);
+            s->ptr = val_ptr + sizeof(int32_t);
             break;
         case WATCHMAN_INT64_MARKER:
-            if (val_ptr + sizeof(int64_t) > end) {
+            if (!watchman_source_fill(s, sizeof(int8_t) + sizeof(int64_t))) {
                 rb_raise(rb_eArgError, "overrun extracting int64_t");
             }
+            val_ptr = s->ptr + sizeof(int8_t);
             val = *(int64_t *)val_ptr;
-            *ptr = val_ptr + sizeof(int64_t);
+            s->ptr = val_ptr + sizeof(int64_t);
             break;
         default:
-            rb_raise(rb_eArgError, "bad integer marker 0x%02x", (unsigned int)*ptr[0]);
+            rb_raise(rb_eArgError, "bad integer marker 0x%02x", (unsigned int)s->ptr[0]);
             break;
     }
 
@@ -260,86 +335,99 @@ int64_t watchman_load_int(char **ptr, char *end) {
 
 /**
  * Reads and returns a string encoded in the Watchman binary protocol format,
- * starting at `ptr` and finishing at or before `end`
+ * starting at `s->ptr`
+ *
+ * When receiving from a socket, the string's bytes are copied into the new
+ * Ruby string as they arrive, so it may be larger than the receive buffer.
  */
-VALUE watchman_load_string(char **ptr, char *end) {
+VALUE watchman_load_string(watchman_source_t *s) {
     int64_t len;
+    size_t n;
+    char *dest;
     VALUE string;
-    if (*ptr >= end) {
+    if (!watchman_source_fill(s, 1)) {
         rb_raise(rb_eArgError, "unexpected end of input");
     }
 
-    if (*ptr[0] != WATCHMAN_STRING_MARKER) {
+    if (s->ptr[0] != WATCHMAN_STRING_MARKER) {
         rb_raise(rb_eArgError, "not a number");
     }
 
-    *ptr += sizeof(int8_t);
-    if (*ptr >= end) {
+    s->ptr += sizeof(int8_t);
+    if (!watchman_source_fill(s, 1)) {
         rb_raise(rb_eArgError, "invalid string header");
     }
 
-    len = watchman_load_int(ptr, end);
+    len = watchman_load_int(s);
     if (len == 0) { // special case for zero-length strings
         return rb_str_new2("");
-    } else if (*ptr + len > end) {
+    } else if (len < 0 || (uint64_t)len > (s->end - s->ptr) + s->pending) {
         rb_raise(rb_eArgError, "insufficient string storage");
     }
 
-    string = rb_str_new(*ptr, len);
-    *ptr += len;
+    string = rb_str_new(NULL, len);
+    dest = RSTRING_PTR(string);
+    while (len) {
+        watchman_source_fill(s, 1);
+        n = s->end - s->ptr < len ? s->end - s->ptr : len;
+        memcpy(dest, s->ptr, n);
+        s->ptr += n;
+        dest += n;
+        len -= n;
+    }
     return string;
 }
 
 /**
  * Reads and returns a double encoded in the Watchman binary protocol format,
- * starting at `ptr` and finishing at or before `end`
+ * starting at `s->ptr`
  */
-double watchman_load_double(char **ptr, char *end) {
+double watchman_load_double(watchman_source_t *s) {
     double val;
-    *ptr += sizeof(int8_t); // caller has already verified the marker
-    if (*ptr + sizeof(double) > end) {
+    s->ptr += sizeof(int8_t); // caller has already verified the marker
+    if (!watchman_source_fill(s, sizeof(double))) {
         rb_raise(rb_eArgError, "insufficient double storage");
     }
-    val = *(double *)*ptr;
-    *ptr += sizeof(double);
+    val = *(double *)s->ptr;
+    s->ptr += sizeof(double);
     return val;
 }
 
 /**
  * Helper method which returns length of the array encoded in the Watchman
- * binary protocol format, starting at `ptr` and finishing at or before `end`
+ * binary protocol format, starting at `s->ptr`
  */
-int64_t watchman_load_array_header(char **ptr, char *end) {
-    if (*ptr >= end) {
+int64_t watchman_load_array_header(watchman_source_t *s) {
+    if (!watchman_source_fill(s, 1)) {
         rb_raise(rb_eArgError, "unexpected end of input");
     }
 
     // verify and consume marker
-    if (*ptr[0] != WATCHMAN_ARRAY_MARKER) {
+    if (s->ptr[0] != WATCHMAN_ARRAY_MARKER) {
         rb_raise(rb_eArgError, "not an array");
     }
-    *ptr += sizeof(int8_t);
+    s->ptr += sizeof(int8_t);
 
     // expect a count
-    if (*ptr + sizeof(int8_t) * 2 > end) {
+    if (!watchman_source_fill(s, sizeof(int8_t) * 2)) {
         rb_raise(rb_eArgError, "incomplete array header");
     }
-    return watchman_load_int(ptr, end);
+    return watchman_load_int(s);
 }
 
 /**
  * Reads and returns an array encoded in the Watchman binary protocol format,
- * starting at `ptr` and finishing at or before `end`
+ * starting at `s->ptr`
  */
-VALUE watchman_load_array(char **ptr, char *end) {
+VALUE watchman_load_array(watchman_source_t *s) {
     int64_t count, i;
     VALUE array;
 
-    count = watchman_load_array_header(ptr, end);
+    count = watchman_load_array_header(s);
     array = rb_ary_new2(count);
 
     for (i = 0; i < count; i++) {
-        rb_ary_push(array, watchman_load(ptr, end));
+        rb_ary_push(array, watchman_load(s));
     }
 
     return array;
@@ -347,25 +435,25 @@ VALUE watchman_load_array(char **ptr, char *end) {
 
 /**
  * Reads and returns a hash encoded in the Watchman binary protocol format,
- * starting at `ptr` and finishing at or before `end`
+ * starting at `s->ptr`
  */
-VALUE watchman_load_hash(char **ptr, char *end) {
+VALUE watchman_load_hash(watchman_source_t *s) {
     int64_t count, i;
     VALUE hash, key, value;
 
-    *ptr += sizeof(int8_t); // caller has already verified the marker
+    s->ptr += sizeof(int8_t); // caller has already verified the marker
 
     // expect a count
-    if (*ptr + sizeof(int8_t) * 2 > end) {
+    if (!watchman_source_fill(s, sizeof(int8_t) * 2)) {
         rb_raise(rb_eArgError, "incomplete hash header");
     }
-    count = watchman_load_int(ptr, end);
+    count = watchman_load_int(s);
 
     hash = rb_hash_new();
 
     for (i = 0; i < count; i++) {
-        key = watchman_load_string(ptr, end);
-        value = watchman_load(ptr, end);
+        key = watchman_load_string(s);
+        value = watchman_load(s);
         rb_hash_aset(hash, key, value);
     }
 
@@ -374,40 +462,40 @@ VALUE watchman_load_hash(char **ptr, char *end) {
 
 /**
  * Reads and returns a templated array encoded in the Watchman binary protocol
- * format, starting at `ptr` and finishing at or before `end`
+ * format, starting at `s->ptr`
  *
  * Templated arrays are arrays of hashes which have repetitive key information
  * pulled out into a separate "headers" prefix.
  *
  * @see https://github.com/facebook/watchman/blob/master/website/_docs/BSER.markdown
  */
-VALUE watchman_load_template(char **ptr, char *end) {
+VALUE watchman_load_template(watchman_source_t *s) {
     int64_t header_items_count, i, row_count;
     VALUE array, hash, header, key, value;
 
-    *ptr += sizeof(int8_t); // caller has already verified the marker
+    s->ptr += sizeof(int8_t); // caller has already verified the marker
 
     // process template header array
-    header_items_count = watchman_load_array_header(ptr, end);
+    header_items_count = watchman_load_array_header(s);
     header = rb_ary_new2(header_items_count);
     for (i = 0; i < header_items_count; i++) {
-        rb_ary_push(header, watchman_load_string(ptr, end));
+        rb_ary_push(header, watchman_load_string(s));
     }
 
     // process row items
-    row_count = watchman_load_int(ptr, end);
+    row_count = watchman_load_int(s);
     array = rb_ary_new2(header_items_count);
     while (row_count--) {
         hash = rb_hash_new();
         for (i = 0; i < header_items_count; i++) {
-            if (*ptr >= end) {
+            if (!watchman_source_fill(s, 1)) {
                 rb_raise(rb_eArgError, "unexpected end of input");
             }
 
-            if (*ptr[0] == WATCHMAN_SKIP_MARKER) {
-                *ptr += sizeof(uint8_t);
+            if (s->ptr[0] == WATCHMAN_SKIP_MARKER) {
+                s->ptr += sizeof(uint8_t);
             } else {
-                value = watchman_load(ptr, end);
+                value = watchman_load(s);
                 key = rb_ary_entry(header, i);
                 rb_hash_aset(hash, key, value);
             }
@@ -419,38 +507,38 @@ VALUE watchman_load_template(char **ptr, char *end) {
 
 /**
  * Reads and returns an object encoded in the Watchman binary protocol format,
- * starting at `ptr` and finishing at or before `end`
+ * starting at `s->ptr`
  */
-VALUE watchman_load(char **ptr, char *end) {
-    if (*ptr >= end) {
+VALUE watchman_load(watchman_source_t *s) {
+    if (!watchman_source_fill(s, 1)) {
         rb_raise(rb_eArgError, "unexpected end of input");
     }
 
-    switch (*ptr[0]) {
+    switch (s->ptr[0]) {
         case WATCHMAN_ARRAY_MARKER:
-            return watchman_load_array(ptr, end);
+            return watchman_load_array(s);
         case WATCHMAN_HASH_MARKER:
-            return watchman_load_hash(ptr, end);
+            return watchman_load_hash(s);
         case WATCHMAN_STRING_MARKER:
-            return watchman_load_string(ptr, end);
+            return watchman_load_string(s);
         case WATCHMAN_INT8_MARKER:
         case WATCHMAN_INT16_MARKER:
         case WATCHMAN_INT32_MARKER:
         case WATCHMAN_INT64_MARKER:
-            return LL2NUM(watchman_load_int(ptr, end));
+            return LL2NUM(watchman_load_int(s));
         case WATCHMAN_FLOAT_MARKER:
-            return rb_float_new(watchman_load_double(ptr, end));
+            return rb_float_new(watchman_load_double(s));
         case WATCHMAN_TRUE:
-            *ptr += 1;
+            s->ptr += 1;
             return Qtrue;
         case WATCHMAN_FALSE:
-            *ptr += 1;
+            s->ptr += 1;
             return Qfalse;
         case WATCHMAN_NIL:
-            *ptr += 1;
+            s->ptr += 1;
             return Qnil;
         case WATCHMAN_TEMPLATE_MARKER:
-            return watchman_load_template(ptr, end);
+            return watchman_load_template(s);
         default:
             rb_raise(rb_eTypeError, "unsupported type");
     }
@@ -465,48 +553,51 @@ VALUE watchman_load(char **ptr, char *end) {
  * format into a normal Ruby object.
  */
 VALUE CommandTWatchmanUtils_load(VALUE self, VALUE serialized) {
-    char *ptr, *end;
     long len;
     uint64_t payload_size;
+    watchman_source_t source;
     VALUE loaded;
     serialized = StringValue(serialized);
     len = RSTRING_LEN(serialized);
-    ptr = RSTRING_PTR(serialized);
-    end = ptr + len;
+    source.ptr = RSTRING_PTR(serialized);
+    source.end = source.ptr + len;
+    source.fileno = -1;
+    source.buffer = NULL;
+    source.pending = 0;
 
     // expect at least the binary marker and a int8_t length counter
     if ((size_t)len < sizeof(WATCHMAN_BINARY_MARKER) - 1 + sizeof(int8_t) * 2) {
         rb_raise(rb_eArgError, "undersized header");
     }
 
-    if (memcmp(ptr, WATCHMAN_BINARY_MARKER, sizeof(WATCHMAN_BINARY_MARKER) - 1)) {
+    if (memcmp(source.ptr, WATCHMAN_BINARY_MARKER, sizeof(WATCHMAN_BINARY_MARKER) - 1)) {
         rb_raise(rb_eArgError, "missing binary marker");
     }
 
     // get size marker
-    ptr += sizeof(WATCHMAN_BINARY_MARKER) - 1;
-    payload_size = watchman_load_int(&ptr, end);
+    source.ptr += sizeof(WATCHMAN_BINARY_MARKER) - 1;
+    payload_size = watchman_load_int(&source);
     if (!payload_size) {
         rb_raise(rb_eArgError, "empty payload");
     }
 
     // sanity check length
-    if (ptr + payload_size != end) {
+    if (source.ptr + payload_size != source.end) {
         rb_raise(
             rb_eArgError,
             "payload size mismatch (%lu)",
-            (unsigned long)(end - (ptr + payload_size))
+            (unsigned long)(source.end - (source.ptr + payload_size))
         );
     }
 
-    loaded = watchman_load(&ptr, end);
+    loaded = watchman_load(&source);
 
     // one more sanity check
-    if (ptr != end) {
+    if (source.ptr != source.end) {
         rb_raise(
             rb_eArgError,
             "payload termination mismatch (%lu)",
-            (unsigned long)(end - ptr)
+            (unsigned long)(source.end - source.ptr)
         );
     }
 
@@ -539,55 +630,37 @@ VALUE CommandTWatchmanUtils_dump(VALUE self, VALUE serializable) {
     return serialized;
 }
 
-/**
- * Helper method for raising a SystemCallError wrapping a lower-level error code
- * coming from the `errno` global variable.
- */
-void watchman_raise_system_call_error(int number) {
-    VALUE error = INT2FIX(number);
-    rb_exc_raise(rb_class_new_instance(1, &error, rb_eSystemCallError));
-}
-
-// How far we have to look to figure out the size of the PDU header
-#define WATCHMAN_SNIFF_BUFFER_SIZE sizeof(WATCHMAN_BINARY_MARKER) - 1 + sizeof(int8_t)
-
-// How far we have to peek, at most, to figure out the size of the PDU itself
-#define WATCHMAN_PEEK_BUFFER_SIZE \
-    sizeof(WATCHMAN_BINARY_MARKER) - 1 + \
-    sizeof(WATCHMAN_INT64_MARKER) + \
-    sizeof(int64_t)
-
 /**
  * CommandT::Watchman::Utils.query(query, socket)
  *
  * Converts `query`, a Watchman query comprising Ruby objects, into the Watchman
  * binary protocol format, transmits it over socket, and unserializes and
  * returns the result.
+ *
+ * The result is decoded as it is received (see `watchman_source_t`), rather
+ * than being received in its entirety first.
  */
 VALUE CommandTWatchmanUtils_query(VALUE self, VALUE query, VALUE socket) {
-    char *payload;
-    int fileno, flags;
-    int8_t peek[WATCHMAN_PEEK_BUFFER_SIZE];
+    int flags;
     int8_t sizes[] = { 0, 0, 0, 1, 2, 4, 8 };
     int8_t sizes_idx;
-    int8_t *pdu_size_ptr;
     int64_t payload_size;
     long query_len;
-    ssize_t peek_size, sent, received;
-    void *buffer;
-    VALUE loaded, serialized;
-    fileno = NUM2INT(rb_funcall(socket, rb_intern("fileno"), 0));
+    ssize_t sent;
+    watchman_source_t source;
+    VALUE buffer, loaded, serialized;
+    source.fileno = NUM2INT(rb_funcall(socket, rb_intern("fileno"), 0));
 
     // do blocking I/O to simplify the following logic
-    flags = fcntl(fileno, F_GETFL);
-    if (fcntl(fileno, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+    flags = fcntl(source.fileno, F_GETFL);
+    if (fcntl(source.fileno, F_SETFL, flags & ~O_NONBLOCK) == -1) {
         rb_raise(rb_eRuntimeError, "unable to clear O_NONBLOCK flag");
     }
 
     // send the message
     serialized = CommandTWatchmanUtils_dump(self, query);
     query_len = RSTRING_LEN(serialized);
-    sent = send(fileno, RSTRING_PTR(serialized), query_len, 0);
+    sent = send(source.fileno, RSTRING_PTR(serialized), query_len, 0);
     if (sent == -1) {
         watchman_raise_system_call_error(errno);
     } else if (sent != query_len) {
@@ -595,51 +668,43 @@ VALUE CommandTWatchmanUtils_query(VALUE self, VALUE query, VALUE socket) {
             query_len, sent);
     }
 
-    // sniff to see how large the header is
-    received = recv(fileno, peek, WATCHMAN_SNIFF_BUFFER_SIZE, MSG_PEEK | MSG_WAITALL);
-    if (received == -1) {
-        watchman_raise_system_call_error(errno);
-    } else if (received != WATCHMAN_SNIFF_BUFFER_SIZE) {
+    // the buffer is a Ruby string so that it's freed even if we raise
+    buffer = rb_str_buf_new(WATCHMAN_RECV_BUFFER_SIZE);
+    source.buffer = RSTRING_PTR(buffer);
+    source.ptr = source.buffer;
+    source.end = source.buffer;
+
+    // receive only as much as is needed to figure out how large the header is
+    source.pending = sizeof(WATCHMAN_BINARY_MARKER) - 1 + sizeof(int8_t);
+    if (!watchman_source_fill(&source, source.pending)) {
         rb_raise(rb_eRuntimeError, "failed to sniff PDU header");
     }
-
-    // peek at size of PDU
-    sizes_idx = peek[sizeof(WATCHMAN_BINARY_MARKER) - 1];
+    if (memcmp(source.ptr, WATCHMAN_BINARY_MARKER, sizeof(WATCHMAN_BINARY_MARKER) - 1)) {
+        rb_raise(rb_eRuntimeError, "missing binary marker");
+    }
+    source.ptr += sizeof(WATCHMAN_BINARY_MARKER) - 1;
+    sizes_idx = source.ptr[0];
     if (sizes_idx < WATCHMAN_INT8_MARKER || sizes_idx > WATCHMAN_INT64_MARKER) {
         rb_raise(rb_eRuntimeError, "bad PDU size marker");
     }
-    peek_size = sizeof(WATCHMAN_BINARY_MARKER) - 1 + sizeof(int8_t) +
-        sizes[sizes_idx];
 
-    received = recv(fileno, peek, peek_size, MSG_PEEK);
-    if (received == -1) {
-        watchman_raise_system_call_error(errno);
-    } else if (received != peek_size) {
-        rb_raise(rb_eRuntimeError, "failed to peek at PDU header");
+    // then the size of the PDU, and then the PDU itself
+    source.pending = sizes[sizes_idx];
+    payload_size = watchman_load_int(&source);
+    if (payload_size <= 0) {
+        rb_raise(rb_eRuntimeError, "bad PDU size");
     }
-    pdu_size_ptr = peek + sizeof(WATCHMAN_BINARY_MARKER) - sizeof(int8_t);
-    payload_size =
-        peek_size +
-        watchman_load_int((char **)&pdu_size_ptr, (char *)peek + peek_size);
-
-    // actually read the PDU
-    buffer = xmalloc(payload_size);
-    if (!buffer) {
+    source.pending = payload_size;
+    loaded = watchman_load(&source);
+    if (source.ptr != source.end || source.pending) {
         rb_raise(
-            rb_eNoMemError,
-            "failed to allocate %lld bytes",
-            (long long int)payload_size
+            rb_eArgError,
+            "payload termination mismatch (%lu)",
+            (unsigned long)((source.end - source.ptr) + source.pending)
         );
     }
-    received = recv(fileno, buffer, payload_size, MSG_WAITALL);
-    if (received == -1) {
-        watchman_raise_system_call_error(errno);
-    } else if (received != payload_size) {
-        rb_raise(rb_eRuntimeError, "failed to load PDU");
-    }
-    payload = (char *)buffer + peek_size;
-    loaded = watchman_load(&payload, payload + payload_size);
-    free(buffer);
+
+    RB_GC_GUARD(buffer);
     return loaded;
 }
 
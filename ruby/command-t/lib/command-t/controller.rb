@@ -309,8 +309,10 @@ module CommandT
         :limit          => match_limit,
         :threads        => CommandT::Util.processor_count,
         :ignore_spaces  => VIM::get_bool('g:CommandTIgnoreSpaces', true),
-        :recurse        => VIM::get_bool('g:CommandTRecursiveMatch', true)
+        :recurse        => VIM::get_bool('g:CommandTRecursiveMatch', true),
+        :positions      => true
       )
+      @match_window.positions = @active_finder.positions
       @match_window.matches = @matches
 
       # Scanner may have overwritten prompt to show progress.
@@ -35,8 +35,25 @@ module CommandT
 
     # Options:
     #   :limit (integer): limit the number of returned matches
-    def sorted_matches_for(str, options = {})
-      @matcher.sorted_matches_for str, options
+    #   :positions (boolean): record match positions (see `positions`)
+    #   :progress_paths (integer), :progress_seconds (float): yield the best
+    #     matches found so far to the block (if given) after this many paths
+    #     or seconds, and again after each further interval (only for limits
+    #     below 10,000)
+    #   :supersede (boolean): cancel any earlier search which is still running
+    #     or waiting to run, instead of waiting for it to finish
+    #
+    # Returns nil if the search is cancelled (by `Matcher#cancel`, or by a
+    # newer search passing `:supersede`) before it completes.
+    def sorted_matches_for(str, options = {}, &block)
+      @matcher.sorted_matches_for str, options, &block
+    end
+
+    # Returns a hash mapping each match returned by the last call to
+    # `sorted_matches_for` to the byte offsets that matched, provided
+    # that the `:positions` option was passed.
+    def positions
+      @matcher.positions
     end
 
     def open_selection(command, selection, options = {})
@@ -218,6 +218,12 @@ module CommandT
       @reverse_list ? _next : _prev
     end
 
+    # Byte offsets of the matched characters within each match, as reported
+    # by `CommandT::Matcher#positions`.
+    def positions=(positions)
+      @positions = positions
+    end
+
     def matches=(matches)
       if matches != @matches
         @matches = matches
@@ -377,13 +383,14 @@ module CommandT
     end
 
     def match_text_for_idx(idx)
-      match = truncated_match @matches[idx].to_s
+      path = @matches[idx].to_s
+      match = truncated_match path
       if idx == @selection
         prefix = SELECTION_MARKER
         suffix = padding_for_selected_match match
       else
         if VIM::has?('syntax') && VIM::has?('conceal')
-          match = match_with_syntax_highlight match
+          match = match_with_syntax_highlight match, path
         end
         prefix = UNSELECTED_MARKER
         suffix = ''
@@ -393,18 +400,39 @@ module CommandT
 
     # Highlight matching characters within the matched string.
     #
-    # Note that this is only approximate; it will highlight the first matching
-    # instances within the string, which may not actually be the instances that
-    # were used by the matching/scoring algorithm to determine the best score
-    # for the match.
+    # Uses the positions reported by the matcher where available. Otherwise,
+    # this is only approximate; it will highlight the first matching instances
+    # within the string, which may not actually be the instances that were used
+    # by the matching/scoring algorithm to determine the best score for the
+    # match.
     #
-    def match_with_syntax_highlight(match)
-      highlight_chars = @prompt.abbrev.downcase.scan(/./mu)
+    def match_with_syntax_highlight(match, path)
       if @encoding &&
          match.respond_to?(:force_encoding) &&
          match.encoding != @encoding
-        match = match.force_encoding(@encoding)
+        match = match.dup.force_encoding(@encoding)
       end
+
+      offsets = @positions && @positions[path]
+      if offsets
+        # Offsets are in bytes, so find the characters (as rendered) which
+        # start at each of them.
+        chars = []
+        indices = {}
+        bytes = 0
+        match.each_char do |char|
+          indices[bytes] = chars.length
+          chars << char
+          bytes += char.bytesize
+        end
+        truncated_offsets(offsets, path).each do |offset|
+          index = indices[offset]
+          chars[index] = MH_START + chars[index] + MH_END if index
+        end
+        return chars.join
+      end
+
+      highlight_chars = @prompt.abbrev.downcase.scan(/./mu)
       match.scan(/./mu).inject([]) do |output, char|
         if char.downcase == highlight_chars.first
           highlight_chars.shift
@@ -470,12 +498,36 @@ module CommandT
     # Convert "really/long/path" into "really...path" based on available
     # window width.
     def truncated_match(str)
-      len = str.length
+      left, right = truncation_for(str.length)
+      return str unless left
+      str[0, left] + '...' + str[-right, right]
+    end
+
+    # Map byte offsets within `path` onto the string produced by
+    # `truncated_match`, dropping any that fall within the elided part.
+    def truncated_offsets(offsets, path)
+      left, right = truncation_for(path.length)
+      return offsets unless left
+      left = path[0, left].bytesize
+      right = path[-right, right].bytesize
+      len = path.bytesize
+      offsets.map do |offset|
+        if offset < left
+          offset
+        elsif offset >= len - right
+          offset - (len - right) + left + 3 # Skip over the "...".
+        end
+      end.compact
+    end
+
+    # Returns the number of characters to keep from the left and right of a
+    # match of length `len`, or nil if it doesn't need to be truncated.
+    def truncation_for(len)
       available_width = @window_width - MARKER_LENGTH
-      return str if len <= available_width
+      return nil if len <= available_width
       left = (available_width / 2) - 1
       right = (available_width / 2) - 2 + (available_width % 2)
-      str[0, left] + '...' + str[-right, right]
+      [left, right]
     end
 
     def clear
@@ -61,11 +61,13 @@ describe CommandT::Controller do
     finder = CommandT::Finder::FileFinder.new
     stub(finder).path = anything
     stub(finder).sorted_matches_for(anything, anything).returns(sorted_matches)
+    stub(finder).positions.returns({})
     stub(CommandT::Finder::FileFinder).new.returns(finder)
   end
 
   def stub_match_window(selection)
     match_window = Object.new
+    stub(match_window).positions = anything
     stub(match_window).matches = anything
     stub(match_window).leave
     stub(match_window).focus
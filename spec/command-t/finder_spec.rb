@@ -0,0 +1,32 @@
+# Copyright 2017-present Greg Hurrell. All rights reserved.
+# Licensed under the terms of the BSD 2-clause license.
+
+require 'spec_helper'
+require 'ostruct'
+
+describe CommandT::Finder do
+  describe '#sorted_matches_for' do
+    before do
+      paths = (0...5000).map { |i| "file#{i}.rb" }
+      @matcher = CommandT::Matcher.new(OpenStruct.new(:paths => paths))
+
+      # Skip the constructor, which is the subclasses' responsibility.
+      @finder = CommandT::Finder.allocate
+      @finder.instance_variable_set(:@matcher, @matcher)
+    end
+
+    it 'returns nil when the search is cancelled before it completes' do
+      results = @finder.sorted_matches_for(
+        'f1',
+        :limit => 5,
+        :progress_paths => 1000
+      ) { @matcher.cancel }
+      expect(results).to be nil
+    end
+
+    it 'searches normally after superseding an earlier search' do
+      expect(@finder.sorted_matches_for('f4999', :supersede => true)).
+        to eq(%w[file4999.rb])
+    end
+  end
+end
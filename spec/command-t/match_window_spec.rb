@@ -0,0 +1,39 @@
+# Copyright 2017-present Greg Hurrell. All rights reserved.
+# Licensed under the terms of the BSD 2-clause license.
+
+require 'spec_helper'
+require 'ostruct'
+
+describe CommandT::MatchWindow do
+  describe '#match_with_syntax_highlight' do
+    # Skip the constructor, which needs a running Vim.
+    def window(width)
+      CommandT::MatchWindow.allocate.tap do |window|
+        window.instance_variable_set(:@encoding, Encoding::UTF_8)
+        window.instance_variable_set(:@window_width, width)
+      end
+    end
+
+    def highlight(window, path, query)
+      matcher = CommandT::Matcher.new(OpenStruct.new(:paths => [path]))
+      matcher.sorted_matches_for(query, :positions => true)
+      window.positions = matcher.positions
+      match = window.send(:truncated_match, path)
+      window.send(:match_with_syntax_highlight, match, path)
+    end
+
+    it 'highlights matches within binary-encoded non-ASCII paths' do
+      path = 'señor/año/x'.b
+      expect(highlight(window(80), path, 'x')).
+        to eq('señor/año/<commandt>x</commandt>')
+      expect(highlight(window(80), path, 'ño')).
+        to eq('se<commandt>ñ</commandt><commandt>o</commandt>r/año/x')
+    end
+
+    it 'highlights matches within truncated paths' do
+      path = ('señor/' * 10 + 'x.rb').b
+      expect(highlight(window(20), path, 'sx')).
+        to match(/\A<commandt>s<\/commandt>.*\.\.\..*<commandt>x<\/commandt>\.rb\z/)
+    end
+  end
+end
@@ -10,6 +10,11 @@ describe CommandT::Matcher do
     CommandT::Matcher.new(scanner)
   end
 
+  # Many similar paths, spread across seven directories.
+  def numbered_paths(count)
+    (0...count).map { |i| "dir#{i % 7}/file#{i}.rb" }
+  end
+
   describe 'initialization' do
     it 'raises an ArgumentError if passed nil' do
       expect { CommandT::Matcher.new(nil) }.to raise_error(ArgumentError)
@@ -48,6 +53,22 @@ describe CommandT::Matcher do
       expect(matches.map { |m| m.to_s }).to eq(['Foo'])
     end
 
+    it 'performs case-insensitive matching of non-ASCII characters' do
+      matches = matcher('foo/ñandú').sorted_matches_for('ÑANDÚ')
+      expect(matches.map { |m| m.to_s }).to eq(['foo/ñandú'])
+    end
+
+    it 'uses Unicode case folding' do
+      matches = matcher("\u212a/foo", 'bar').sorted_matches_for('k')
+      expect(matches.map { |m| m.to_s }).to eq(["\u212a/foo"])
+    end
+
+    it 'reports the byte offsets of matched non-ASCII characters' do
+      matcher = matcher('señor/año')
+      matcher.sorted_matches_for('ÑO', :positions => true)
+      expect(matcher.positions).to eq('señor/año' => [2, 4])
+    end
+
     it 'considers the space character to match a literal space' do
       paths = ['path_no_space', 'path with/space']
       matches = matcher(*paths).sorted_matches_for('path space')
@@ -67,12 +88,165 @@ describe CommandT::Matcher do
       expect(matches.map { |m| m.to_s }).to eq(['foo'])
     end
 
+    it 'returns the alphabetically first visible paths for an empty query' do
+      matcher = matcher(*%w[d .b/a c a])
+      expect(matcher.sorted_matches_for('', :limit => 2)).to eq(%w[a c])
+    end
+
+    it 'returns the alphabetically first matches for a "." query' do
+      matcher = matcher(*%w[z.rb a/very/deep/path/to/file.rb b])
+      expect(matcher.sorted_matches_for('.', :limit => 1)).to eq(%w[a/very/deep/path/to/file.rb])
+    end
+
     # Can't imagine this happening in practice, but want to handle it in case.
     it 'gracefully handles empty haystacks' do
       expect(matcher('', 'foo').sorted_matches_for('').map { |m| m.to_s }).to eq(['', 'foo'])
       expect(matcher('', 'foo').sorted_matches_for('f').map { |m| m.to_s }).to eq(['foo'])
     end
 
+    it 'uses digits and punctuation to reject candidates in later searches' do
+      matcher = matcher(*%w[v2_api.rb v_api.rb foo.rb foorb])
+      expect(matcher.sorted_matches_for('')).to eq(%w[foo.rb foorb v2_api.rb v_api.rb])
+      expect(matcher.sorted_matches_for('v2_api')).to eq(%w[v2_api.rb])
+      expect(matcher.sorted_matches_for('foo.rb')).to eq(%w[foo.rb])
+    end
+
+    it 'returns the same results when repeating an unlimited search' do
+      matcher = matcher(*%w[b a])
+      expect(matcher.sorted_matches_for('a', :limit => 0)).to eq(%w[a])
+      expect(matcher.sorted_matches_for('a', :limit => 0)).to eq(%w[a])
+    end
+
+    it 'returns the top matches when the limit is large' do
+      paths = numbered_paths(30000)
+      all = matcher(*paths).sorted_matches_for('d3f1', :limit => 0)
+      expect(matcher(*paths).sorted_matches_for('d3f1', :limit => 12000)).
+        to eq(all.first(12000))
+    end
+
+    it 'returns the same results when searching repeatedly with threads' do
+      paths = numbered_paths(2000)
+      expected = matcher(*paths).sorted_matches_for('d3f12', :threads => 1)
+      matcher = matcher(*paths)
+      3.times do
+        expect(matcher.sorted_matches_for('d3f1', :threads => 4).size).to eq(15)
+        expect(matcher.sorted_matches_for('d3f12', :threads => 4)).to eq(expected)
+      end
+    end
+
+    it 'returns the same results when searching from several threads at once' do
+      paths = numbered_paths(2000)
+      expected = matcher(*paths).sorted_matches_for('d3f12')
+      matcher = matcher(*paths)
+      threads = (1..4).map do
+        Thread.new { matcher.sorted_matches_for('d3f12', :threads => 2) }
+      end
+      threads.each { |thread| expect(thread.value).to eq(expected) }
+    end
+
+    it 'reports per-thread statistics when asked' do
+      paths = numbered_paths(5000)
+      matcher = matcher(*paths)
+      matcher.sorted_matches_for('d3f1', :threads => 3, :thread_stats => true)
+      expect(matcher.thread_stats.size).to eq(3)
+      expect(matcher.thread_stats.map { |stats| stats[:paths] }.inject(:+)).to eq(5000)
+      matcher.sorted_matches_for('d3f1', :threads => 3)
+      expect(matcher.thread_stats).to eq(nil)
+    end
+
+    it 'returns the same results after deleting characters from the query' do
+      paths = %w[foo/bar foo/baz fab/bar fob]
+      matcher = matcher(*paths)
+      %w[f fb fbz fb f fo].each do |query|
+        expected = matcher(*paths).sorted_matches_for(query)
+        expect(matcher.sorted_matches_for(query)).to eq(expected)
+      end
+      expect(matcher.sorted_matches_for('fbz')).to eq(%w[foo/baz])
+    end
+
+    it 'lists paths in the same order before and after ranking them' do
+      paths = %w[b/c a .x b a/b ab]
+      expected = matcher(*paths).sorted_matches_for('', :limit => 3)
+      matcher = matcher(*paths)
+      matcher.sorted_matches_for('z', :limit => 0) # Sorts every match, by rank.
+      expect(matcher.sorted_matches_for('', :limit => 3)).to eq(expected)
+      expect(expected).to eq(%w[a a/b ab])
+    end
+
+    it 'returns the same results after deleting and retyping characters' do
+      paths = %w[
+        rt-c/.c
+        rt-c/.cc
+        rt-cc/.c
+        r/.rt-cc
+        .rt/cc
+        src/rt-cc.rb
+        rt/c/c
+      ]
+      matcher = matcher(*paths)
+      %w[r rt rt- rt-c rt-cc rt-c rt- rt-cc].each do |query|
+        expected = matcher(*paths).sorted_matches_for(query, :positions => true)
+        expect(matcher.sorted_matches_for(query, :positions => true)).
+          to eq(expected)
+      end
+      expect(matcher.sorted_matches_for('rt-cc').sort).
+        to eq(%w[rt-cc/.c src/rt-cc.rb])
+    end
+
+    it 'does not reuse earlier results after a change of case sensitivity' do
+      matcher = matcher(*%w[Foo foo])
+      expect(matcher.sorted_matches_for('f', :case_sensitive => true)).to eq(%w[foo])
+      expect(matcher.sorted_matches_for('fo').sort).to eq(%w[Foo foo])
+    end
+
+    it 'raises an ArgumentError for a negative survivor_depth' do
+      scanner = OpenStruct.new(:paths => [])
+      expect do
+        CommandT::Matcher.new(scanner, :survivor_depth => -1)
+      end.to raise_error(ArgumentError)
+    end
+
+    it 'answers repeated searches from the cache' do
+      matcher = matcher(*%w[foo/bar foo/baz bing])
+      first = matcher.sorted_matches_for('fb')
+      matcher.sorted_matches_for('fbz')
+      expect(matcher.sorted_matches_for('fb')).to eq(first)
+      expect(matcher.sorted_matches_for('fb', :limit => 1).size).to eq(1)
+      expect(matcher.cache_hits).to eq(1)
+      expect(matcher.cache_misses).to eq(3)
+    end
+
+    it 'does not serve cached results after the paths change' do
+      scanner = OpenStruct.new(:paths => %w[foo])
+      matcher = CommandT::Matcher.new(scanner)
+      expect(matcher.sorted_matches_for('f')).to eq(%w[foo])
+      scanner.paths = %w[foo fab]
+      expect(matcher.sorted_matches_for('f').sort).to eq(%w[fab foo])
+      expect(matcher.cache_hits).to eq(0)
+    end
+
+    it 'yields provisional results while searching when asked' do
+      paths = numbered_paths(5000)
+      expected = matcher(*paths).sorted_matches_for('d3f1', :limit => 5)
+      provisional = []
+      matcher = matcher(*paths)
+      results = matcher.sorted_matches_for(
+        'd3f1',
+        :limit => 5,
+        :progress_paths => 1000
+      ) { |matches| provisional << matches }
+      expect(results).to eq(expected)
+      expect(provisional.size).to be >= 3
+      provisional.each { |matches| expect(matches.size).to be <= 5 }
+    end
+
+    it 'only cancels searches that have already started' do
+      matcher = matcher(*%w[foo bar])
+      matcher.cancel
+      expect(matcher.sorted_matches_for('f')).to eq(%w[foo])
+      expect(matcher.sorted_matches_for('b', :supersede => true)).to eq(%w[bar])
+    end
+
     it 'does not consider mere substrings of the query string to be a match' do
       expect(matcher('foo').sorted_matches_for('foo...')).to eq([])
     end
@@ -278,6 +452,53 @@ describe CommandT::Matcher do
       expect(matcher.sorted_matches_for('s')).to eq([])
     end
 
+    it 'still finds candidates which were skipped by an earlier search' do
+      matcher = matcher(*%w[a some/longer/path/to/a/b])
+      expect(matcher.sorted_matches_for('a', :limit => 1)).to eq(%w[a])
+      expect(matcher.sorted_matches_for('ab', :limit => 1)).
+        to eq(%w[some/longer/path/to/a/b])
+    end
+
+    it 'produces the same ordering with the recursive and iterative engines' do
+      paths = %w[
+        app/controllers/heartbeat_controller.rb
+        app/controllers/articles_controller.rb
+        a**/****r******/**t*c***_*on*******.**
+        ***/***********/art*****_con*******.**
+        static_upstream/relay/query/RelayQueryPath.js
+        this/.secret/stuff.txt
+      ]
+      %w[artcon aca relqpath t.sst a].each do |query|
+        [true, false].each do |recurse|
+          recursive = matcher(*paths).sorted_matches_for(query,
+            :engine => :recursive, :limit => 0, :recurse => recurse)
+          iterative = matcher(*paths).sorted_matches_for(query,
+            :engine => :iterative, :limit => 0, :recurse => recurse)
+          expect(iterative).to eq(recursive)
+        end
+      end
+    end
+
+    it 'raises an ArgumentError for an unknown engine' do
+      expect { matcher('foo').sorted_matches_for('f', :engine => :magic) }.
+        to raise_error(ArgumentError)
+    end
+
+    it 'reports the positions of matched characters' do
+      matcher = matcher(*%w[
+        app/controllers/articles_controller.rb
+        app/models/article.rb
+      ])
+      matcher.sorted_matches_for('artcon', :positions => true, :recurse => true)
+      expect(matcher.positions).to eq(
+        'app/controllers/articles_controller.rb' => [16, 17, 18, 25, 26, 27]
+      )
+      matcher.sorted_matches_for('', :positions => true)
+      expect(matcher.positions['app/models/article.rb']).to eq([])
+      matcher.sorted_matches_for('art')
+      expect(matcher.positions).to eq(nil)
+    end
+
     it 'correctly computes non-recursive match score' do
       # Non-recursive match was incorrectly inflating some scores.
       # Related: https://github.com/wincent/command-t/issues/209
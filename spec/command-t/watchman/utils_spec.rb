@@ -2,6 +2,7 @@
 # Licensed under the terms of the BSD 2-clause license.
 
 require 'spec_helper'
+require 'socket'
 
 describe CommandT::Watchman::Utils do
   def binary(str)
@@ -412,4 +413,32 @@ describe CommandT::Watchman::Utils do
       expect(expected).to include(described_class.dump(query))
     end
   end
+
+  describe '.query' do
+    let(:sockets) { UNIXSocket.pair }
+
+    after do
+      sockets.each(&:close)
+    end
+
+    it 'decodes a response larger than its receive buffer' do
+      files = (0...2000).map { |i| "some/dir#{i % 13}/file#{i}.rb" }
+      response = { 'version' => '4.9', 'files' => files, 'clock' => 1.5 }
+      sockets[1].write(described_class.dump(response))
+      expect(described_class.query(['query'], sockets[0])).to eq(response)
+    end
+
+    it 'stops reading at the end of the response' do
+      sockets[1].write(described_class.dump('first') + described_class.dump('second'))
+      expect(described_class.query(['query'], sockets[0])).to eq('first')
+      expect(described_class.query(['query'], sockets[0])).to eq('second')
+    end
+
+    it 'rejects truncated responses' do
+      sockets[1].write(described_class.dump(['one', 'two'])[0...-3])
+      sockets[1].close_write
+      expect { described_class.query(['query'], sockets[0]) }.
+        to raise_error(RuntimeError, /failed to load PDU/)
+    end
+  end
 end